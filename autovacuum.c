@@ -0,0 +1,468 @@
+#ifndef __linux__
+#error "Linux control groups are only available on Linux"
+#endif
+
+#include "postgres.h"
+
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+
+#include "pg_cgroups.h"
+
+/*
+ * The autovacuum I/O policy moves autovacuum workers to a group and
+ * adapts the block I/O budget of that group to the headroom of the
+ * disk that contains the data directory.  The monitor calls it after
+ * each sample.  From the utilization of the disk and the bytes that the
+ * cluster and the group transferred, it estimates what the disk can do,
+ * and it gives autovacuum the part of that which the target utilization
+ * leaves after the foreground I/O.  So autovacuum speeds up when the
+ * cluster is quiet and backs off when foreground I/O rises.
+ *
+ * Optionally, the budget is converted to "autovacuum_vacuum_cost_limit",
+ * which is written to AUTOVACUUM_FILE in the data directory, so that
+ * the workers sleep in the cost-based delay rather than being throttled
+ * by the kernel while they hold buffer locks.
+ */
+
+#define AUTOVACUUM_FILE "pg_cgroups.autovacuum.conf"
+
+/* adapt the budget at most that often */
+#define POLICY_INTERVAL 1000	/* ms */
+
+/* rewrite the cost limit at most that often */
+#define FEEDBACK_INTERVAL 60000	/* ms */
+
+/* below that utilization, the capacity of the disk cannot be estimated */
+#define MIN_UTILIZATION 0.05
+
+/* upper bound for the budget if there is no maximum */
+#define MAX_BUDGET INT64CONST(1099511627776)	/* 1 TB per second */
+
+/* GUCs defined by the policy */
+static char *autovacuum_group = NULL;
+static int autovacuum_min_io_rate = 1;
+static int autovacuum_max_io_rate = 0;
+static double autovacuum_io_utilization = 0.8;
+static bool autovacuum_cost_feedback = false;
+
+/* state of the policy, reset when it is disabled */
+static char *device = NULL;			/* the disk, "major:minor" */
+static char *throttled_group = NULL;	/* the group that has the budget */
+static TimestampTz last_time = 0;
+static int64_t last_ticks;			/* ms that the disk was busy */
+static int64_t last_cluster_bytes;
+static int64_t last_group_bytes;
+static double capacity = -1.0;		/* estimated bytes per second at full utilization */
+static int64_t budget = -1;			/* bytes per second, -1 if not set */
+static TimestampTz feedback_time = 0;
+static int feedback_limit = -1;		/* the cost limit in AUTOVACUUM_FILE */
+
+/* static functions declarations */
+static bool autovacuum_group_check(char **newval, void **extra, GucSource source);
+static bool read_disk_ticks(int64_t *ticks);
+static int64_t device_io_bytes(char * const stat, char * const dev);
+static void set_group_budget(char * const group, int64_t bytes);
+static void reset_policy(void);
+static void cost_feedback(char * const group);
+static void write_cost_limit(char * const group, int limit);
+
+/*
+ * Define the GUCs.
+ * This is called from _PG_init().
+ */
+void
+autovacuum_init(void)
+{
+	DefineCustomStringVariable(
+		"pg_cgroups.autovacuum_group",
+		"The group for autovacuum workers.",
+		"An empty string means the cluster's control group.  "
+		"The block I/O of the group is adapted to the load of the disk.",
+		&autovacuum_group,
+		"",
+		PGC_SIGHUP,
+		0,
+		autovacuum_group_check,
+		NULL,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"pg_cgroups.autovacuum_min_io_rate",
+		"Minimal block I/O budget of autovacuum in MB per second.",
+		"This is only used if \"pg_cgroups.autovacuum_group\" is set.",
+		&autovacuum_min_io_rate,
+		1,
+		1,
+		INT_MAX / 2,
+		PGC_SIGHUP,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"pg_cgroups.autovacuum_max_io_rate",
+		"Maximal block I/O budget of autovacuum in MB per second.",
+		"0 means no maximum.  This is only used if \"pg_cgroups.autovacuum_group\" is set.",
+		&autovacuum_max_io_rate,
+		0,
+		0,
+		INT_MAX / 2,
+		PGC_SIGHUP,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomRealVariable(
+		"pg_cgroups.autovacuum_io_utilization",
+		"Disk utilization up to which autovacuum may use the disk.",
+		"This is only used if \"pg_cgroups.autovacuum_group\" is set.",
+		&autovacuum_io_utilization,
+		0.8,
+		0.1,
+		1.0,
+		PGC_SIGHUP,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomBoolVariable(
+		"pg_cgroups.autovacuum_cost_feedback",
+		"Derive \"autovacuum_vacuum_cost_limit\" from the block I/O budget of autovacuum.",
+		"This is only used if \"pg_cgroups.autovacuum_group\" is set.",
+		&autovacuum_cost_feedback,
+		false,
+		PGC_SIGHUP,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+}
+
+bool
+autovacuum_group_check(char **newval, void **extra, GucSource source)
+{
+	if (**newval == '\0')
+		return true;
+
+	if (!group_exists(*newval))
+	{
+		GUC_check_errdetail(
+			"Group \"%s\" is not defined in \"pg_cgroups.groups\".",
+			*newval
+		);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Read the milliseconds that the disk was busy (the tenth field
+ * of the "stat" file of the block device).
+ */
+bool
+read_disk_ticks(int64_t *ticks)
+{
+	char *path;
+	FILE *file;
+	long long fields[10];
+	int count;
+
+	path = system_path(psprintf("/sys/dev/block/%s/stat", device));
+	file = AllocateFile(path, "r");
+	pfree(path);
+
+	if (file == NULL)
+		return false;
+
+	count = fscanf(file, "%lld %lld %lld %lld %lld %lld %lld %lld %lld %lld",
+				   &fields[0], &fields[1], &fields[2], &fields[3], &fields[4],
+				   &fields[5], &fields[6], &fields[7], &fields[8], &fields[9]);
+	FreeFile(file);
+
+	if (count != 10)
+		return false;
+
+	*ticks = (int64_t) fields[9];
+
+	return true;
+}
+
+/*
+ * Sum up the bytes read and written on a device in the contents of
+ * "blkio.throttle.io_service_bytes", which consists of lines of the form
+ * "major:minor operation value".
+ */
+int64_t
+device_io_bytes(char * const stat, char * const dev)
+{
+	char *p = stat;
+	size_t len = strlen(dev);
+	int64_t sum = 0;
+
+	while (p != NULL && *p != '\0')
+	{
+		if (strncmp(p, dev, len) == 0 && p[len] == ' ')
+		{
+			if (strncmp(p + len + 1, "Read ", 5) == 0)
+				sum += strtoll(p + len + 6, NULL, 10);
+			else if (strncmp(p + len + 1, "Write ", 6) == 0)
+				sum += strtoll(p + len + 7, NULL, 10);
+		}
+
+		if ((p = strchr(p, '\n')) != NULL)
+			++p;
+	}
+
+	return sum;
+}
+
+/* set the read and write limit of a group on the disk, 0 means no limit */
+void
+set_group_budget(char * const group, int64_t bytes)
+{
+	char *value = psprintf("%s " INT64_FORMAT, device, (int64) bytes);
+
+	cg_set_group_string(CONTROLLER_BLKIO, group, "blkio.throttle.read_bps_device", value);
+	cg_set_group_string(CONTROLLER_BLKIO, group, "blkio.throttle.write_bps_device", value);
+
+	pfree(value);
+}
+
+/* remove the budget and forget the measurements */
+void
+reset_policy(void)
+{
+	if (throttled_group != NULL)
+	{
+		set_group_budget(throttled_group, 0);
+		pfree(throttled_group);
+		throttled_group = NULL;
+	}
+
+	last_time = 0;
+	capacity = -1.0;
+	budget = -1;
+}
+
+/*
+ * Move new autovacuum workers to "pg_cgroups.autovacuum_group" and
+ * adapt the block I/O budget of the group.
+ * This is called by the monitor after each sample.
+ */
+void
+autovacuum_io_policy(void)
+{
+	TimestampTz now = GetCurrentTimestamp();
+	char *stat;
+	int64_t ticks, cluster_bytes, group_bytes, target, min_budget, max_budget;
+	double seconds, utilization, vacuum_rate, foreground_rate;
+
+	if (*autovacuum_group == '\0')
+	{
+		reset_policy();
+		if (feedback_limit != -1)
+			write_cost_limit(NULL, -1);
+		return;
+	}
+
+	place_processes("autovacuum worker", autovacuum_group);
+
+	/* the group was changed */
+	if (throttled_group != NULL && strcmp(throttled_group, autovacuum_group) != 0)
+		reset_policy();
+
+	if (device == NULL)
+	{
+		device = get_disk_device(DataDir);
+		if (device == NULL)
+			return;
+		device = MemoryContextStrdup(TopMemoryContext, device);
+	}
+
+	if (last_time != 0
+		&& !TimestampDifferenceExceeds(last_time, now, POLICY_INTERVAL))
+		return;
+
+	if (!read_disk_ticks(&ticks))
+	{
+		static bool warned = false;
+
+		if (!warned)
+			ereport(LOG,
+					(errmsg("cannot read the statistics of device %s, the autovacuum I/O budget is not adapted",
+							device)));
+		warned = true;
+		return;
+	}
+
+	if ((stat = cluster_io_stat("blkio.throttle.io_service_bytes")) == NULL)
+		return;
+	cluster_bytes = device_io_bytes(stat, device);
+	pfree(stat);
+
+	if ((stat = cg_get_group_string(CONTROLLER_BLKIO, autovacuum_group,
+									"blkio.throttle.io_service_bytes",
+									true)) == NULL)
+		return;
+	group_bytes = device_io_bytes(stat, device);
+	pfree(stat);
+
+	if (throttled_group == NULL)
+		throttled_group = MemoryContextStrdup(TopMemoryContext, autovacuum_group);
+
+	min_budget = (int64_t) autovacuum_min_io_rate * 1048576;
+	max_budget = (autovacuum_max_io_rate == 0) ? MAX_BUDGET
+					: (int64_t) autovacuum_max_io_rate * 1048576;
+
+	/* the first call only takes measurements */
+	if (last_time == 0)
+	{
+		target = (budget == -1) ? min_budget : budget;
+	}
+	else
+	{
+		seconds = (now - last_time) / 1000000.0;
+		utilization = Min((ticks - last_ticks) / 1000.0 / seconds, 1.0);
+		vacuum_rate = (group_bytes - last_group_bytes) / seconds;
+		foreground_rate = Max(cluster_bytes - last_cluster_bytes
+								- (group_bytes - last_group_bytes), 0) / seconds;
+
+		/*
+		 * I/O from outside the cluster also counts towards the utilization,
+		 * which makes the estimate lower and the policy more careful.
+		 */
+		if (utilization >= MIN_UTILIZATION && vacuum_rate + foreground_rate > 0)
+		{
+			double estimate = (vacuum_rate + foreground_rate) / utilization;
+
+			capacity = (capacity < 0.0) ? estimate
+						: 0.7 * capacity + 0.3 * estimate;
+		}
+
+		if (utilization < MIN_UTILIZATION || capacity < 0.0)
+			/* the disk is idle, so widen the budget */
+			target = (budget == -1) ? max_budget : budget * 2;
+		else
+			target = (int64_t) (capacity * autovacuum_io_utilization - foreground_rate);
+	}
+
+	target = Max(Min(target, max_budget), min_budget);
+
+	/* avoid rewriting the limits for small changes */
+	if (budget == -1 || target > budget * 21 / 20 || target < budget * 19 / 20)
+	{
+		set_group_budget(autovacuum_group, target);
+		budget = target;
+
+		elog(DEBUG1, "autovacuum I/O budget on device %s is " INT64_FORMAT " bytes per second",
+			 device, (int64) budget);
+	}
+
+	last_time = now;
+	last_ticks = ticks;
+	last_cluster_bytes = cluster_bytes;
+	last_group_bytes = group_bytes;
+
+	cost_feedback(autovacuum_group);
+}
+
+/*
+ * Convert the budget to the cost limit that makes autovacuum read
+ * that many bytes per second from disk, given the cost delay and
+ * "vacuum_cost_page_miss".  The limit is shared by all workers,
+ * just like the budget.
+ */
+void
+cost_feedback(char * const group)
+{
+	TimestampTz now = GetCurrentTimestamp();
+	const char *delay_str;
+	double delay;
+	int limit;
+
+	if (!autovacuum_cost_feedback)
+	{
+		if (feedback_limit != -1)
+			write_cost_limit(group, -1);
+		return;
+	}
+
+	if (feedback_time != 0
+		&& !TimestampDifferenceExceeds(feedback_time, now, FEEDBACK_INTERVAL))
+		return;
+
+	delay_str = GetConfigOption("autovacuum_vacuum_cost_delay", false, false);
+	delay = strtod(delay_str, NULL);
+	if (delay < 0)
+		delay = strtod(GetConfigOption("vacuum_cost_delay", false, false), NULL);
+
+	/* without a delay, there is no cost-based throttling */
+	if (delay <= 0)
+		return;
+
+	limit = (int) Max(Min((double) budget / BLCKSZ * VacuumCostPageMiss * delay / 1000.0,
+						  10000.0),
+					  1.0);
+
+	/* only tell the workers about substantial changes */
+	if (feedback_limit == -1
+		|| limit > feedback_limit * 11 / 10 || limit < feedback_limit * 9 / 10)
+		write_cost_limit(group, limit);
+
+	feedback_time = now;
+}
+
+/*
+ * Write "autovacuum_vacuum_cost_limit" to AUTOVACUUM_FILE, or only
+ * a comment if "limit" is -1, and make the autovacuum workers in the
+ * group reload the configuration.  Other processes see the new value
+ * with the next reload.
+ */
+void
+write_cost_limit(char * const group, int limit)
+{
+	StringInfoData contents;
+	char *path, *processes, *p, *q;
+
+	initStringInfo(&contents);
+	appendStringInfoString(&contents,
+						   "# Written by pg_cgroups from the block I/O budget\n"
+						   "# of autovacuum.  Do not edit this file.\n");
+	if (limit != -1)
+		appendStringInfo(&contents, "autovacuum_vacuum_cost_limit = %d\n", limit);
+
+	path = psprintf("%s/%s", DataDir, AUTOVACUUM_FILE);
+	if (!write_config_file(path, contents.data))
+		return;
+
+	feedback_limit = limit;
+
+	if (group == NULL)
+		return;
+
+	/* the file has one process ID per line */
+	processes = cg_get_group_string(CONTROLLER_BLKIO, group, "cgroup.procs", true);
+	for (p = processes; p != NULL && (q = strchr(p, '\n')) != NULL; p = q + 1)
+	{
+		*q = '\0';
+		(void) kill((pid_t) atoi(p), SIGHUP);
+	}
+}
@@ -0,0 +1,497 @@
+#ifndef __linux__
+#error "Linux control groups are only available on Linux"
+#endif
+
+#include "postgres.h"
+
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/postmaster.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "tcop/tcopprot.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "pg_cgroups.h"
+
+/*
+ * The exporter is a background worker that periodically writes the
+ * cgroup counters of the cluster and its groups to a file in the
+ * Prometheus text format, for the textfile collector of the node exporter.
+ * The file is written under a temporary name and renamed, so that the
+ * collector never sees a partial file.
+ * The parameter files are opened once and read again from the start
+ * for each sample.
+ */
+
+/* how to get a value from a parameter file */
+#define VALUE_PLAIN 0	/* the file contains only the value */
+#define VALUE_STAT  1	/* the line "key value" */
+#define VALUE_IO    2	/* the sum of "major:minor key value" lines */
+#define VALUE_PSI   3	/* "total=" from the line that starts with "key" */
+
+/* definition of a metric */
+typedef struct
+{
+	char *name;				/* without the "pg_cgroups_" prefix */
+	char *type;				/* "gauge" or "counter" */
+	char *help;
+	int controller;
+	char *parameter;		/* for the cluster */
+	char *group_parameter;	/* for groups, if different */
+	int kind;				/* VALUE_* */
+	char *key;
+	double scale;			/* multiply with this, 0 means 1 */
+} Metric;
+
+static const Metric metrics[] = {
+	{"memory_usage_bytes", "gauge", "Memory used by the control group.",
+	 CONTROLLER_MEMORY, "memory.usage_in_bytes", NULL, VALUE_PLAIN, NULL, 0},
+	{"memory_max_usage_bytes", "gauge", "Highest memory usage of the control group.",
+	 CONTROLLER_MEMORY, "memory.max_usage_in_bytes", NULL, VALUE_PLAIN, NULL, 0},
+	{"memory_limit_bytes", "gauge", "Memory limit of the control group, absent if unlimited.",
+	 CONTROLLER_MEMORY, "memory.limit_in_bytes", NULL, VALUE_PLAIN, NULL, 0},
+	{"memory_failures_total", "counter", "Times the memory usage hit the limit.",
+	 CONTROLLER_MEMORY, "memory.failcnt", NULL, VALUE_PLAIN, NULL, 0},
+	{"memory_anon_bytes", "gauge", "Anonymous memory of the control group.",
+	 CONTROLLER_MEMORY, "memory.stat", NULL, VALUE_STAT, "total_rss", 0},
+	{"memory_cache_bytes", "gauge", "File system cache of the control group.",
+	 CONTROLLER_MEMORY, "memory.stat", NULL, VALUE_STAT, "total_cache", 0},
+	{"memory_shmem_bytes", "gauge", "Shared memory of the control group.",
+	 CONTROLLER_MEMORY, "memory.stat", NULL, VALUE_STAT, "total_shmem", 0},
+	{"memory_active_file_bytes", "gauge", "Active file system cache of the control group.",
+	 CONTROLLER_MEMORY, "memory.stat", NULL, VALUE_STAT, "total_active_file", 0},
+	{"memory_inactive_file_bytes", "gauge", "Inactive file system cache of the control group.",
+	 CONTROLLER_MEMORY, "memory.stat", NULL, VALUE_STAT, "total_inactive_file", 0},
+	{"memory_dirty_bytes", "gauge", "Dirty file system cache of the control group.",
+	 CONTROLLER_MEMORY, "memory.stat", NULL, VALUE_STAT, "total_dirty", 0},
+	{"memory_writeback_bytes", "gauge", "File system cache under writeback.",
+	 CONTROLLER_MEMORY, "memory.stat", NULL, VALUE_STAT, "total_writeback", 0},
+	{"memory_swap_bytes", "gauge", "Swap used by the control group.",
+	 CONTROLLER_MEMORY, "memory.stat", NULL, VALUE_STAT, "total_swap", 0},
+	{"memory_under_oom", "gauge", "1 if the control group is out of memory.",
+	 CONTROLLER_MEMORY, "memory.oom_control", NULL, VALUE_STAT, "under_oom", 0},
+	{"memory_oom_kills_total", "counter", "Processes killed by the OOM killer.",
+	 CONTROLLER_MEMORY, "memory.oom_control", NULL, VALUE_STAT, "oom_kill", 0},
+	{"cpu_usage_seconds_total", "counter", "CPU time used by the control group.",
+	 CONTROLLER_CPU, "cpuacct.usage", NULL, VALUE_PLAIN, NULL, 1e-9},
+	{"cpu_periods_total", "counter", "CPU quota periods.",
+	 CONTROLLER_CPU, "cpu.stat", NULL, VALUE_STAT, "nr_periods", 0},
+	{"cpu_throttled_periods_total", "counter", "CPU quota periods in which the control group was throttled.",
+	 CONTROLLER_CPU, "cpu.stat", NULL, VALUE_STAT, "nr_throttled", 0},
+	{"cpu_throttled_seconds_total", "counter", "Time the control group was throttled.",
+	 CONTROLLER_CPU, "cpu.stat", NULL, VALUE_STAT, "throttled_time", 1e-9},
+	{"blkio_read_bytes_total", "counter", "Bytes read from block devices.",
+	 CONTROLLER_BLKIO, "blkio.throttle.io_service_bytes_recursive",
+	 "blkio.throttle.io_service_bytes", VALUE_IO, "Read", 0},
+	{"blkio_write_bytes_total", "counter", "Bytes written to block devices.",
+	 CONTROLLER_BLKIO, "blkio.throttle.io_service_bytes_recursive",
+	 "blkio.throttle.io_service_bytes", VALUE_IO, "Write", 0},
+	{"blkio_reads_total", "counter", "Read operations on block devices.",
+	 CONTROLLER_BLKIO, "blkio.throttle.io_serviced_recursive",
+	 "blkio.throttle.io_serviced", VALUE_IO, "Read", 0},
+	{"blkio_writes_total", "counter", "Write operations on block devices.",
+	 CONTROLLER_BLKIO, "blkio.throttle.io_serviced_recursive",
+	 "blkio.throttle.io_serviced", VALUE_IO, "Write", 0},
+	{"pids_current", "gauge", "Processes in the control group.",
+	 CONTROLLER_PIDS, "pids.current", NULL, VALUE_PLAIN, NULL, 0},
+	{"pids_fork_failures_total", "counter", "Forks that failed because of the process limit.",
+	 CONTROLLER_PIDS, "pids.events", NULL, VALUE_STAT, "max", 0},
+	{"cpu_pressure_some_seconds_total", "counter", "Time some processes waited for CPU.",
+	 CONTROLLER_CPU, "cpu.pressure", NULL, VALUE_PSI, "some", 1e-6},
+	{"memory_pressure_some_seconds_total", "counter", "Time some processes waited for memory.",
+	 CONTROLLER_CPU, "memory.pressure", NULL, VALUE_PSI, "some", 1e-6},
+	{"memory_pressure_full_seconds_total", "counter", "Time all processes waited for memory.",
+	 CONTROLLER_CPU, "memory.pressure", NULL, VALUE_PSI, "full", 1e-6},
+	{"io_pressure_some_seconds_total", "counter", "Time some processes waited for I/O.",
+	 CONTROLLER_CPU, "io.pressure", NULL, VALUE_PSI, "some", 1e-6},
+	{"io_pressure_full_seconds_total", "counter", "Time all processes waited for I/O.",
+	 CONTROLLER_CPU, "io.pressure", NULL, VALUE_PSI, "full", 1e-6}
+};
+
+#define NUM_METRICS lengthof(metrics)
+
+/* file descriptor that was not opened yet */
+#define FD_UNOPENED -2
+
+/* GUCs defined by the exporter */
+static char *metrics_file = NULL;
+static int metrics_interval = 15;
+
+/* the groups, where the first entry is NULL for the cluster */
+static char **group_names = NULL;
+static int num_groups = 0;
+
+/* open file descriptors for each group and metric, -1 if not available */
+static int (*descriptors)[NUM_METRICS] = NULL;
+
+/* set by the SIGHUP handler */
+static volatile sig_atomic_t got_sighup = false;
+
+/* static functions declarations */
+static void exporter_sighup(SIGNAL_ARGS);
+static void init_descriptors(void);
+static char *read_descriptor(int fd);
+static bool metric_value(int group, int metric, double *value);
+static void append_label_value(StringInfo buf, const char *value);
+static void write_metrics(void);
+
+/* entry point of the background worker */
+PGDLLEXPORT void exporter_main(Datum main_arg);
+
+/*
+ * Define the GUCs and register the background worker
+ * if a metrics file is configured.
+ * This is called from _PG_init().
+ */
+void
+exporter_init(void)
+{
+	BackgroundWorker worker;
+
+	DefineCustomStringVariable(
+		"pg_cgroups.metrics_file",
+		"File to which the cgroup counters are written in the Prometheus text format.",
+		"An empty string disables the exporter.",
+		&metrics_file,
+		"",
+		PGC_POSTMASTER,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"pg_cgroups.metrics_interval",
+		"Interval between two updates of the metrics file.",
+		NULL,
+		&metrics_interval,
+		15,
+		1,
+		3600,
+		PGC_SIGHUP,
+		GUC_UNIT_S,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	if (metrics_file[0] == '\0')
+		return;
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+	worker.bgw_start_time = BgWorkerStart_PostmasterStart;
+	worker.bgw_restart_time = 10;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "pg_cgroups");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "exporter_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "pg_cgroups exporter");
+#if PG_VERSION_NUM >= 110000
+	snprintf(worker.bgw_type, BGW_MAXLEN, "pg_cgroups exporter");
+#endif
+
+	RegisterBackgroundWorker(&worker);
+}
+
+void
+exporter_sighup(SIGNAL_ARGS)
+{
+	int save_errno = errno;
+
+	got_sighup = true;
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
+/*
+ * Find the groups and mark all descriptors as not opened yet.
+ * The groups can only change with a restart.
+ */
+void
+init_descriptors(void)
+{
+	MemoryContext oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+	char *list, *name;
+	int i, j;
+
+	list = group_list();
+
+	/* there cannot be more groups than characters */
+	group_names = palloc(sizeof(char *) * (strlen(list) + 2));
+	group_names[num_groups++] = NULL;
+	while ((name = next_group(&list)) != NULL)
+		group_names[num_groups++] = name;
+
+	descriptors = palloc(sizeof(*descriptors) * num_groups);
+	for (i=0; i<num_groups; ++i)
+		for (j=0; j<NUM_METRICS; ++j)
+			descriptors[i][j] = FD_UNOPENED;
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Read an open parameter file from the start.
+ * Returns a palloc'ed string or NULL on error.
+ */
+char *
+read_descriptor(int fd)
+{
+	char *result;
+	size_t size = 1024, len = 0;
+	ssize_t bytes;
+
+	if (lseek(fd, 0, SEEK_SET) == -1)
+		return NULL;
+
+	result = palloc(size);
+	while ((bytes = read(fd, result + len, size - len - 1)) > 0)
+	{
+		len += bytes;
+		if (len + 1 == size)
+		{
+			size *= 2;
+			result = repalloc(result, size);
+		}
+	}
+
+	if (bytes == -1)
+	{
+		pfree(result);
+		return NULL;
+	}
+
+	result[len] = '\0';
+
+	return result;
+}
+
+/*
+ * Get the value of a metric for a group (0 is the cluster).
+ * Returns false if the value is not available.
+ */
+bool
+metric_value(int group, int metric, double *value)
+{
+	const Metric *m = &metrics[metric];
+	int *fd = &descriptors[group][metric];
+	char *contents, *p;
+	int64_t v = -1;
+
+	if (!cg_has_controller(m->controller))
+		return false;
+
+	/* open the parameter file the first time we need it */
+	if (*fd == FD_UNOPENED)
+		*fd = cg_open_parameter(m->controller,
+								group_names[group],
+								(group > 0 && m->group_parameter)
+									? m->group_parameter : m->parameter);
+
+	if (*fd == -1)
+	{
+		/* older kernels have no "_recursive" files, then add up the groups */
+		if (m->kind != VALUE_IO || group > 0
+			|| (contents = cluster_io_stat(m->group_parameter)) == NULL)
+			return false;
+	}
+	else if ((contents = read_descriptor(*fd)) == NULL)
+		return false;
+
+	switch (m->kind)
+	{
+		case VALUE_PLAIN:
+			/* "pids.max" and similar can contain "max" */
+			if (contents[0] >= '0' && contents[0] <= '9')
+				v = strtoll(contents, NULL, 10);
+			break;
+		case VALUE_STAT:
+			v = cg_stat_value(contents, m->key);
+			break;
+		case VALUE_IO:
+			v = sum_io_stat(contents, m->key);
+			break;
+		case VALUE_PSI:
+			/* lines look like "some avg10=0.00 avg60=0.00 avg300=0.00 total=0" */
+			for (p = contents; p != NULL && *p != '\0'; )
+			{
+				if (strncmp(p, m->key, strlen(m->key)) == 0
+					&& (p = strstr(p, "total=")) != NULL)
+				{
+					v = strtoll(p + 6, NULL, 10);
+					break;
+				}
+				if ((p = strchr(p, '\n')) != NULL)
+					++p;
+			}
+			break;
+	}
+
+	pfree(contents);
+
+	/* without a limit, the kernel reports a huge number */
+	if (v < 0 || v >= INT64CONST(0x7FFFFFFFFFFFF000) / 2)
+		return false;
+
+	*value = (m->scale == 0) ? (double) v : v * m->scale;
+
+	return true;
+}
+
+/* append a label value, escaped for the Prometheus text format */
+void
+append_label_value(StringInfo buf, const char *value)
+{
+	const char *p;
+
+	appendStringInfoChar(buf, '"');
+	for (p = value; *p != '\0'; ++p)
+	{
+		if (*p == '\\' || *p == '"')
+		{
+			appendStringInfoChar(buf, '\\');
+			appendStringInfoChar(buf, *p);
+		}
+		else if (*p == '\n')
+			appendStringInfoString(buf, "\\n");
+		else
+			appendStringInfoChar(buf, *p);
+	}
+	appendStringInfoChar(buf, '"');
+}
+
+/*
+ * Write all metrics to a temporary file and rename it to "metrics_file".
+ * The samples of the cluster have an empty "group" label.
+ * Errors are logged, and we try again next time.
+ */
+void
+write_metrics(void)
+{
+	StringInfoData buf, labels;
+	char *tmpfile;
+	FILE *file;
+	int i, j;
+
+	/* these labels are the same for all samples */
+	initStringInfo(&labels);
+	appendStringInfoString(&labels, "data_directory=");
+	append_label_value(&labels, DataDir);
+	appendStringInfo(&labels, ",port=\"%d\"", PostPortNumber);
+
+	initStringInfo(&buf);
+	for (j=0; j<NUM_METRICS; ++j)
+	{
+		bool header = false;
+
+		for (i=0; i<num_groups; ++i)
+		{
+			double value;
+
+			if (!metric_value(i, j, &value))
+				continue;
+
+			/* all samples of a metric must follow its header */
+			if (!header)
+			{
+				appendStringInfo(&buf, "# HELP pg_cgroups_%s %s\n",
+								 metrics[j].name, metrics[j].help);
+				appendStringInfo(&buf, "# TYPE pg_cgroups_%s %s\n",
+								 metrics[j].name, metrics[j].type);
+				header = true;
+			}
+
+			appendStringInfo(&buf, "pg_cgroups_%s{%s,group=",
+							 metrics[j].name, labels.data);
+			append_label_value(&buf, group_names[i] ? group_names[i] : "");
+			if (metrics[j].scale == 0)
+				appendStringInfo(&buf, "} %.0f\n", value);
+			else
+				appendStringInfo(&buf, "} %.9f\n", value);
+		}
+	}
+
+	tmpfile = psprintf("%s.tmp", metrics_file);
+
+	if ((file = AllocateFile(tmpfile, "w")) == NULL)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("cannot open \"%s\" for writing: %m", tmpfile)));
+		return;
+	}
+
+	if (fwrite(buf.data, 1, buf.len, file) != (size_t) buf.len)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("error writing file \"%s\": %m", tmpfile)));
+		FreeFile(file);
+		(void) unlink(tmpfile);
+		return;
+	}
+
+	if (FreeFile(file) != 0 || rename(tmpfile, metrics_file) != 0)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("cannot rename \"%s\" to \"%s\": %m", tmpfile, metrics_file)));
+		(void) unlink(tmpfile);
+	}
+}
+
+void
+exporter_main(Datum main_arg)
+{
+	MemoryContext write_context;
+
+	pqsignal(SIGHUP, exporter_sighup);
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	init_descriptors();
+
+	/* this is reset after each update */
+	write_context = AllocSetContextCreate(TopMemoryContext,
+										  "pg_cgroups exporter",
+										  ALLOCSET_DEFAULT_SIZES);
+
+	for (;;)
+	{
+		MemoryContext oldcontext;
+		int rc;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (got_sighup)
+		{
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		oldcontext = MemoryContextSwitchTo(write_context);
+		write_metrics();
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(write_context);
+
+		rc = WaitLatch(MyLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   metrics_interval * 1000L,
+					   PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+	}
+}
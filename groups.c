@@ -0,0 +1,1542 @@
+#ifndef __linux__
+#error "Linux control groups are only available on Linux"
+#endif
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+
+#include "access/htup_details.h"
+#include "libpq/auth.h"
+#include "libpq/libpq-be.h"
+#include "miscadmin.h"
+#include "replication/walsender.h"
+#include "storage/ipc.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "pg_cgroups.h"
+#include "pg_cgroups_api.h"
+
+/*
+ * Groups are child control groups of the cluster's control group
+ * that contain some of the cluster's processes.  They are subject to
+ * the limits of the cluster and can be frozen and thawed as a whole.
+ */
+
+PG_FUNCTION_INFO_V1(pg_cgroups_freeze);
+PG_FUNCTION_INFO_V1(pg_cgroups_thaw);
+PG_FUNCTION_INFO_V1(pg_cgroups_processes);
+PG_FUNCTION_INFO_V1(pg_cgroups_io_stat);
+
+/* GUCs for groups */
+static char *groups = NULL;
+static char *group = NULL;
+static char *freeze_groups = NULL;
+static int freeze_threshold = 90;
+static int thaw_threshold = 80;
+static int max_freeze_time = 300;
+static char *group_max_processes = NULL;
+static char *group_io_weight = NULL;
+static char *replication_group = NULL;
+static char *role_groups = NULL;
+static char *database_groups = NULL;
+static char *replication_net_priority = NULL;
+static char *replication_classid = NULL;
+
+/* the block I/O weight parameter of the I/O scheduler and its default */
+static char *io_weight_param = NULL;
+static int64_t def_io_weight;
+static int64_t min_io_weight;	/* CFQ doesn't accept weights below 10 */
+
+/* the network priorities last written, to reset removed interfaces */
+static char *applied_net_priority = NULL;
+
+/* groups requested by other extensions, see "pg_cgroups_api.h" */
+static char *extension_groups = NULL;
+
+/* the group that contains this process, NULL for the cluster's group */
+static char *current_group = NULL;
+
+/* saved hook value */
+static ClientAuthentication_hook_type prev_client_auth_hook = NULL;
+
+/* state of the freeze policy, only used in the monitor */
+static char *policy_frozen = NULL;	/* the groups frozen by the policy */
+static TimestampTz policy_freeze_time;
+static bool policy_timed_out = false;
+
+/* functions for other extensions, see "pg_cgroups_api.h" */
+PGDLLEXPORT void pg_cgroups_api_request_group(const char *name, const PgCgroupsLimits *limits);
+PGDLLEXPORT bool pg_cgroups_api_join_group(const char *name);
+
+/* static functions declarations */
+static bool valid_group_name(char * const name);
+static bool check_group_list(char * const list, bool must_exist);
+static bool groups_check(char **newval, void **extra, GucSource source);
+static bool freeze_groups_check(char **newval, void **extra, GucSource source);
+static bool group_check(char **newval, void **extra, GucSource source);
+static void group_assign(const char *newval, void *extra);
+static void groups_client_auth(Port *port, int status);
+static void freeze_group_list(char * const list, bool freeze);
+static void thaw_on_exit(int code, Datum arg);
+static bool group_max_processes_check(char **newval, void **extra, GucSource source);
+static void group_max_processes_assign(const char *newval, void *extra);
+static bool group_io_weight_check(char **newval, void **extra, GucSource source);
+static void group_io_weight_assign(const char *newval, void *extra);
+static bool io_weight_valid(int64_t weight);
+static bool group_mapping_check(char **newval, void **extra, GucSource source);
+static char *group_mapping(char * const list, char * const name);
+static bool net_priority_check(char **newval, void **extra, GucSource source);
+static void net_priority_assign(const char *newval, void *extra);
+static void write_net_priorities(char * const list, bool reset);
+static bool classid_check(char **newval, void **extra, GucSource source);
+static void classid_assign(const char *newval, void *extra);
+
+/*
+ * Define the GUCs and create the groups.
+ * This is called from _PG_init().
+ */
+void
+groups_init(void)
+{
+	char *list, *name, *value;
+
+	DefineCustomStringVariable(
+		"pg_cgroups.groups",
+		"Groups that are created in the cluster's control group.",
+		"This is a comma separated list of group names.",
+		&groups,
+		"",
+		PGC_POSTMASTER,
+		0,
+		groups_check,
+		NULL,
+		NULL
+	);
+
+	/* create the groups before their parameters are set */
+	list = pstrdup(groups);
+	while ((name = next_group(&list)) != NULL)
+		cg_create_group(name);
+
+	DefineCustomStringVariable(
+		"pg_cgroups.group",
+		"The group that contains the backend process.",
+		"An empty string means the cluster's control group.",
+		&group,
+		"",
+		PGC_SUSET,
+		0,
+		group_check,
+		group_assign,
+		NULL
+	);
+
+	DefineCustomStringVariable(
+		"pg_cgroups.role_groups",
+		"Groups for the sessions of roles.",
+		"This is a comma separated list of \"role group\" entries.",
+		&role_groups,
+		"",
+		PGC_SIGHUP,
+		0,
+		group_mapping_check,
+		NULL,
+		NULL
+	);
+
+	DefineCustomStringVariable(
+		"pg_cgroups.database_groups",
+		"Groups for the sessions in databases.",
+		"This is a comma separated list of \"database group\" entries.  "
+		"\"pg_cgroups.role_groups\" takes precedence.",
+		&database_groups,
+		"",
+		PGC_SIGHUP,
+		0,
+		group_mapping_check,
+		NULL,
+		NULL
+	);
+
+	DefineCustomStringVariable(
+		"pg_cgroups.replication_group",
+		"The group for WAL senders and the archiver.",
+		"An empty string means the cluster's control group.",
+		&replication_group,
+		"",
+		PGC_POSTMASTER,
+		0,
+		group_check,
+		NULL,
+		NULL
+	);
+
+	DefineCustomStringVariable(
+		"pg_cgroups.freeze_groups",
+		"Groups that are frozen if the cluster is short of memory.",
+		"This is a comma separated list of group names.",
+		&freeze_groups,
+		"",
+		PGC_SIGHUP,
+		0,
+		freeze_groups_check,
+		NULL,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"pg_cgroups.freeze_threshold",
+		"Memory usage in percent of the memory limit that freezes groups.",
+		"This is only used if \"pg_cgroups.freeze_groups\" is set.",
+		&freeze_threshold,
+		90,
+		1,
+		100,
+		PGC_SIGHUP,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"pg_cgroups.thaw_threshold",
+		"Memory usage in percent of the memory limit that thaws frozen groups.",
+		"This is only used if \"pg_cgroups.freeze_groups\" is set.",
+		&thaw_threshold,
+		80,
+		0,
+		100,
+		PGC_SIGHUP,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"pg_cgroups.max_freeze_time",
+		"Maximum time that groups stay frozen.",
+		"This is only used if \"pg_cgroups.freeze_groups\" is set.",
+		&max_freeze_time,
+		300,
+		1,
+		INT_MAX,
+		PGC_SIGHUP,
+		GUC_UNIT_S,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	if (cg_has_controller(CONTROLLER_PIDS))
+		DefineCustomStringVariable(
+			"pg_cgroups.group_max_processes",
+			"Limit the number of processes in groups.",
+			"This is a comma separated list of \"group limit\" entries "
+			"and corresponds to \"pids.max\" of the groups.",
+			&group_max_processes,
+			"",
+			PGC_SIGHUP,
+			0,
+			group_max_processes_check,
+			group_max_processes_assign,
+			NULL
+		);
+
+	if (cg_has_controller(CONTROLLER_NET_PRIO))
+		DefineCustomStringVariable(
+			"pg_cgroups.replication_net_priority",
+			"Network priorities for the replication group.",
+			"This is a comma separated list of \"interface priority\" entries "
+			"and corresponds to \"net_prio.ifpriomap\".",
+			&replication_net_priority,
+			"",
+			PGC_SIGHUP,
+			0,
+			net_priority_check,
+			net_priority_assign,
+			NULL
+		);
+
+	if (cg_has_controller(CONTROLLER_NET_CLS))
+		DefineCustomStringVariable(
+			"pg_cgroups.replication_classid",
+			"Traffic control class of the replication group.",
+			"The format is \"major:minor\" with hexadecimal numbers like for \"tc\".  "
+			"This corresponds to \"net_cls.classid\".",
+			&replication_classid,
+			"",
+			PGC_SIGHUP,
+			0,
+			classid_check,
+			classid_assign,
+			NULL
+		);
+
+	/* BFQ and CFQ have different weight parameters */
+	if ((value = cg_get_string(CONTROLLER_BLKIO, "blkio.bfq.weight", true)) != NULL)
+	{
+		io_weight_param = "blkio.bfq.weight";
+		min_io_weight = 1;
+	}
+	else if ((value = cg_get_string(CONTROLLER_BLKIO, "blkio.weight", true)) != NULL)
+	{
+		io_weight_param = "blkio.weight";
+		min_io_weight = 10;
+	}
+
+	if (io_weight_param != NULL)
+	{
+		/* BFQ shows the default as "default <weight>" */
+		def_io_weight = strtoll(strncmp(value, "default ", 8) == 0 ? value + 8 : value,
+								NULL, 10);
+		pfree(value);
+
+		DefineCustomStringVariable(
+			"pg_cgroups.group_io_weight",
+			"Relative weight of groups for block I/O.",
+			"This is a comma separated list of \"group weight\" entries "
+			"and corresponds to \"blkio.weight\" or \"blkio.bfq.weight\" of the groups.",
+			&group_io_weight,
+			"",
+			PGC_SIGHUP,
+			0,
+			group_io_weight_check,
+			group_io_weight_assign,
+			NULL
+		);
+	}
+
+	prev_client_auth_hook = ClientAuthentication_hook;
+	ClientAuthentication_hook = groups_client_auth;
+}
+
+/*
+ * Get the next name from a comma separated list of group names.
+ * The list is modified, and "list" is advanced to the next entry.
+ * Returns NULL at the end of the list.
+ */
+char *
+next_group(char **list)
+{
+	char *p = *list, *name, *end;
+
+	if (p == NULL)
+		return NULL;
+
+	while (*p == ' ')
+		++p;
+
+	if (*p == '\0')
+	{
+		*list = NULL;
+		return NULL;
+	}
+
+	name = p;
+	if ((p = strchr(p, ',')) != NULL)
+	{
+		*p = '\0';
+		*list = p + 1;
+	}
+	else
+		*list = NULL;
+
+	/* remove trailing spaces */
+	end = name + strlen(name);
+	while (end > name && end[-1] == ' ')
+		*(--end) = '\0';
+
+	return name;
+}
+
+/* group names consist of lower case letters, digits and underscores */
+bool
+valid_group_name(char * const name)
+{
+	char *p;
+
+	if (*name == '\0' || strlen(name) > MAX_GROUP_NAME)
+		return false;
+
+	for (p = name; *p != '\0'; ++p)
+		if (!((*p >= 'a' && *p <= 'z') || (*p >= '0' && *p <= '9') || *p == '_'))
+			return false;
+
+	return true;
+}
+
+/*
+ * Check a comma separated list of group names.
+ * If "must_exist" is true, the groups must be in "pg_cgroups.groups".
+ */
+bool
+check_group_list(char * const list, bool must_exist)
+{
+	char *p = pstrdup(list), *name;
+
+	while ((name = next_group(&p)) != NULL)
+	{
+		if (!valid_group_name(name))
+		{
+			GUC_check_errdetail(
+				"Group name \"%s\" must consist of up to %d lower case letters, digits and underscores.",
+				name, MAX_GROUP_NAME
+			);
+			return false;
+		}
+
+		if (must_exist && !group_exists(name))
+		{
+			GUC_check_errdetail(
+				"Group \"%s\" is not defined in \"pg_cgroups.groups\".",
+				name
+			);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool
+groups_check(char **newval, void **extra, GucSource source)
+{
+	return check_group_list(*newval, false);
+}
+
+bool
+freeze_groups_check(char **newval, void **extra, GucSource source)
+{
+	return check_group_list(*newval, true);
+}
+
+bool
+group_check(char **newval, void **extra, GucSource source)
+{
+	if (**newval == '\0')
+		return true;
+
+	if (!group_exists(*newval))
+	{
+		GUC_check_errdetail(
+			"Group \"%s\" is not defined in \"pg_cgroups.groups\".",
+			*newval
+		);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Move client backends to the group.
+ * Other processes stay in the cluster's control group.
+ */
+void
+group_assign(const char *newval, void *extra)
+{
+	char *new_group = (*newval == '\0') ? NULL : (char *) newval;
+
+	if (MyProcPort == NULL)
+		return;
+
+	/* nothing to do if the process is already in that group */
+	if ((new_group == NULL && current_group == NULL)
+		|| (new_group != NULL && current_group != NULL
+			&& strcmp(new_group, current_group) == 0))
+		return;
+
+	if (!cg_move_to_group(new_group, MyProcPid))
+	{
+		ereport(WARNING,
+				(errcode(ERRCODE_SYSTEM_ERROR),
+				 errmsg("cannot move process %d to group \"%s\"",
+						MyProcPid, new_group ? new_group : "")));
+		return;
+	}
+
+	if (current_group != NULL)
+		pfree(current_group);
+	current_group = (new_group == NULL) ? NULL
+						: MemoryContextStrdup(TopMemoryContext, new_group);
+
+	oom_backend_policy(current_group);
+}
+
+/*
+ * Check a comma separated list of entries of the form "group value",
+ * where "group" is defined in "pg_cgroups.groups" and "value"
+ * is a non-negative integer.  Each group can appear only once.
+ */
+bool
+check_group_settings(char * const list)
+{
+	char *p = pstrdup(list), *entry, *value, *seen = pstrdup("");
+
+	while ((entry = next_group(&p)) != NULL)
+	{
+		char *v;
+
+		if ((value = strchr(entry, ' ')) == NULL)
+		{
+			GUC_check_errdetail(
+				"Entry \"%s\" must have a space between group and value.",
+				entry
+			);
+			return false;
+		}
+
+		*(value++) = '\0';
+		while (*value == ' ')
+			++value;
+
+		if (!valid_group_name(entry) || !group_exists(entry))
+		{
+			GUC_check_errdetail(
+				"Group \"%s\" is not defined in \"pg_cgroups.groups\".",
+				entry
+			);
+			return false;
+		}
+
+		if (group_setting(seen, entry) != -1)
+		{
+			GUC_check_errdetail(
+				"Group \"%s\" appears more than once.",
+				entry
+			);
+			return false;
+		}
+		seen = psprintf("%s%s 0,", seen, entry);
+
+		for (v = value; *v >= '0' && *v <= '9'; ++v)
+			;
+		if (*v != '\0' || v == value || v - value > 18)
+		{
+			GUC_check_errdetail(
+				"Value \"%s\" must be an integer number.",
+				value
+			);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Find the value for a group in a list that has passed check_group_settings().
+ * Returns -1 if there is no entry for the group.
+ */
+int64_t
+group_setting(char * const list, char * const name)
+{
+	char *p = pstrdup(list), *freeme = p, *entry;
+	size_t len = strlen(name);
+	int64_t result = -1;
+
+	while ((entry = next_group(&p)) != NULL)
+		if (strncmp(entry, name, len) == 0 && entry[len] == ' ')
+		{
+			result = strtoll(entry + len, NULL, 10);
+			break;
+		}
+
+	pfree(freeme);
+
+	return result;
+}
+
+bool
+group_max_processes_check(char **newval, void **extra, GucSource source)
+{
+	char *list, *name;
+
+	if (!check_group_settings(*newval))
+		return false;
+
+	list = pstrdup(groups);
+	while ((name = next_group(&list)) != NULL)
+	{
+		if (group_setting(*newval, name) == 0)
+		{
+			GUC_check_errdetail(
+				"The limit for group \"%s\" cannot be 0, since then no process could join it.",
+				name
+			);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void
+group_max_processes_assign(const char *newval, void *extra)
+{
+	char *list, *name;
+
+	/* only the postmaster changes the kernel */
+	if (MyProcPid != PostmasterPid)
+		return;
+
+	list = pstrdup(groups);
+	while ((name = next_group(&list)) != NULL)
+	{
+		int64_t limit = group_setting((char *) newval, name);
+
+		if (limit == -1)
+			cg_set_group_string(CONTROLLER_PIDS, name, "pids.max", "max");
+		else
+		{
+			char value[25];	/* long enough for an int64 */
+
+			snprintf(value, 25, INT64_FORMAT, limit);
+			cg_set_group_string(CONTROLLER_PIDS, name, "pids.max", value);
+		}
+	}
+}
+
+bool
+group_io_weight_check(char **newval, void **extra, GucSource source)
+{
+	char *list, *name;
+
+	if (!check_group_settings(*newval))
+		return false;
+
+	list = pstrdup(groups);
+	while ((name = next_group(&list)) != NULL)
+	{
+		int64_t weight = group_setting(*newval, name);
+
+		if (weight != -1 && !io_weight_valid(weight))
+		{
+			GUC_check_errdetail(
+				"The weight for group \"%s\" must be between %d and 1000.",
+				name, (int) min_io_weight
+			);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* the range depends on the I/O scheduler */
+bool
+io_weight_valid(int64_t weight)
+{
+	return (weight >= min_io_weight && weight <= 1000);
+}
+
+void
+group_io_weight_assign(const char *newval, void *extra)
+{
+	char *list, *name;
+
+	/* only the postmaster changes the kernel */
+	if (MyProcPid != PostmasterPid)
+		return;
+
+	list = pstrdup(groups);
+	while ((name = next_group(&list)) != NULL)
+	{
+		int64_t weight = group_setting((char *) newval, name);
+		char value[25];	/* long enough for an int64 */
+
+		snprintf(value, 25, INT64_FORMAT, (weight == -1) ? def_io_weight : weight);
+		cg_set_group_string(CONTROLLER_BLKIO, name, io_weight_param, value);
+	}
+}
+
+/*
+ * Check a comma separated list of "interface priority" entries.
+ */
+bool
+net_priority_check(char **newval, void **extra, GucSource source)
+{
+	char *p = pstrdup(*newval), *entry, *value, *v;
+	struct stat statbuf;
+
+	while ((entry = next_group(&p)) != NULL)
+	{
+		if ((value = strchr(entry, ' ')) == NULL)
+		{
+			GUC_check_errdetail(
+				"Entry \"%s\" must have a space between interface and priority.",
+				entry
+			);
+			return false;
+		}
+
+		*(value++) = '\0';
+		while (*value == ' ')
+			++value;
+
+		if (strlen(entry) > 15 || strchr(entry, '/') != NULL
+			|| stat(psprintf("%s/%s", system_path("/sys/class/net"), entry), &statbuf) == -1)
+		{
+			GUC_check_errdetail(
+				"Network interface \"%s\" does not exist.",
+				entry
+			);
+			return false;
+		}
+
+		for (v = value; *v >= '0' && *v <= '9'; ++v)
+			;
+		if (*v != '\0' || v == value || v - value > 9)
+		{
+			GUC_check_errdetail(
+				"Priority \"%s\" must be an integer number.",
+				value
+			);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Write the priorities of a list that has passed net_priority_check()
+ * to "net_prio.ifpriomap" of the replication group, or reset them to 0.
+ * The kernel takes one entry per write.
+ */
+void
+write_net_priorities(char * const list, bool reset)
+{
+	char *p = pstrdup(list), *entry;
+
+	while ((entry = next_group(&p)) != NULL)
+	{
+		if (reset)
+			*strchr(entry, ' ') = '\0';
+
+		cg_set_group_string(CONTROLLER_NET_PRIO,
+							replication_group,
+							"net_prio.ifpriomap",
+							reset ? psprintf("%s 0", entry) : entry);
+	}
+}
+
+void
+net_priority_assign(const char *newval, void *extra)
+{
+	/* only the postmaster changes the kernel */
+	if (MyProcPid != PostmasterPid || *replication_group == '\0')
+		return;
+
+	if (applied_net_priority != NULL)
+	{
+		write_net_priorities(applied_net_priority, true);
+		pfree(applied_net_priority);
+	}
+
+	write_net_priorities((char *) newval, false);
+	applied_net_priority = MemoryContextStrdup(TopMemoryContext, newval);
+}
+
+/* the class ID has the form "major:minor" with hexadecimal numbers */
+bool
+classid_check(char **newval, void **extra, GucSource source)
+{
+	unsigned int major, minor;
+	char rest;
+
+	if (**newval == '\0')
+		return true;
+
+	if (sscanf(*newval, "%x:%x%c", &major, &minor, &rest) != 2
+		|| major > 0xffff || minor > 0xffff)
+	{
+		GUC_check_errdetail(
+			"The class ID must have the form \"major:minor\" with hexadecimal numbers up to ffff."
+		);
+		return false;
+	}
+
+	return true;
+}
+
+void
+classid_assign(const char *newval, void *extra)
+{
+	unsigned int major = 0, minor = 0;
+
+	/* only the postmaster changes the kernel */
+	if (MyProcPid != PostmasterPid || *replication_group == '\0')
+		return;
+
+	if (*newval != '\0')
+		(void) sscanf(newval, "%x:%x", &major, &minor);
+
+	cg_set_group_string(CONTROLLER_NET_CLS,
+						replication_group,
+						"net_cls.classid",
+						psprintf("%u", (major << 16) | minor));
+}
+
+/*
+ * Backends inherit "pg_cgroups.group" from the postmaster without
+ * running the assign hook, so move them to the group when they start.
+ * If the role or the database is mapped to a group, set the parameter
+ * with a source that the settings from ALTER ROLE and ALTER DATABASE,
+ * which are processed later, override, but a reload does not.
+ */
+void
+groups_client_auth(Port *port, int status)
+{
+	char *mapped = NULL;
+
+	if (prev_client_auth_hook)
+		prev_client_auth_hook(port, status);
+
+	if (status != STATUS_OK)
+		return;
+
+	/* the postmaster's defaults predate any CPU or memory hotplug */
+	refresh_online_defaults();
+
+	/* WAL senders go to the replication group */
+	if (am_walsender && *replication_group != '\0')
+	{
+		group_assign(replication_group, NULL);
+		oom_backend_policy(current_group);
+		return;
+	}
+
+	if (port->user_name != NULL)
+		mapped = group_mapping(role_groups, port->user_name);
+	if (mapped == NULL && port->database_name != NULL)
+		mapped = group_mapping(database_groups, port->database_name);
+
+	if (mapped != NULL)
+		SetConfigOption("pg_cgroups.group", mapped, PGC_SUSET, PGC_S_GLOBAL);
+	else
+		group_assign(group, NULL);
+
+	oom_backend_policy(current_group);
+}
+
+/*
+ * Check a comma separated list of "name group" entries, where "name"
+ * is a role or database name and "group" is an existing group.
+ */
+bool
+group_mapping_check(char **newval, void **extra, GucSource source)
+{
+	char *p = pstrdup(*newval), *entry, *value, *seen = pstrdup("");
+
+	while ((entry = next_group(&p)) != NULL)
+	{
+		if ((value = strchr(entry, ' ')) == NULL)
+		{
+			GUC_check_errdetail(
+				"Entry \"%s\" must have a space between name and group.",
+				entry
+			);
+			return false;
+		}
+
+		*(value++) = '\0';
+		while (*value == ' ')
+			++value;
+
+		if (!valid_group_name(value) || !group_exists(value))
+		{
+			GUC_check_errdetail(
+				"Group \"%s\" is not defined in \"pg_cgroups.groups\".",
+				value
+			);
+			return false;
+		}
+
+		if (group_mapping(seen, entry) != NULL)
+		{
+			GUC_check_errdetail(
+				"Name \"%s\" appears more than once.",
+				entry
+			);
+			return false;
+		}
+		seen = psprintf("%s%s %s,", seen, entry, value);
+	}
+
+	return true;
+}
+
+/*
+ * Find the group for a name in a list of "name group" entries.
+ * Returns a palloc'ed group name or NULL if the name is not in the list.
+ * This only scans a string in the process's memory, so it does not
+ * add noticeably to the connection time.
+ */
+char *
+group_mapping(char * const list, char * const name)
+{
+	char *p, *freeme, *entry, *result = NULL;
+	size_t len = strlen(name);
+
+	if (list == NULL)
+		return NULL;
+
+	freeme = p = pstrdup(list);
+	while ((entry = next_group(&p)) != NULL)
+		if (strncmp(entry, name, len) == 0 && entry[len] == ' ')
+		{
+			entry += len;
+			while (*entry == ' ')
+				++entry;
+			result = pstrdup(entry);
+			break;
+		}
+
+	pfree(freeme);
+
+	return result;
+}
+
+/*
+ * The archiver is not a backend, so the monitor calls this regularly
+ * to move it to the replication group.
+ */
+void
+place_archiver(void)
+{
+	if (*replication_group != '\0')
+		place_processes("archiver", replication_group);
+}
+
+/*
+ * Get the process title of a PostgreSQL process without the prefix
+ * "postgres: [cluster_name: ]", like "archiver".
+ * Returns a palloc'ed string or NULL if that is not a PostgreSQL process.
+ */
+char *
+process_kind(pid_t pid)
+{
+	char *title, *t, *result = NULL;
+
+	if ((title = get_process_title(pid)) == NULL)
+		return NULL;
+
+	t = title;
+	if (strncmp(t, "postgres: ", 10) == 0)
+	{
+		t += 10;
+		if (cluster_name != NULL && *cluster_name != '\0'
+			&& strncmp(t, cluster_name, strlen(cluster_name)) == 0
+			&& strncmp(t + strlen(cluster_name), ": ", 2) == 0)
+			t += strlen(cluster_name) + 2;
+
+		result = pstrdup(t);
+	}
+
+	pfree(title);
+
+	return result;
+}
+
+/*
+ * Find the processes in the cluster's control group whose process title
+ * starts with "title", like "archiver", and move them to the group.
+ * Processes that are not backends can only be found that way.
+ */
+void
+place_processes(char * const title, char * const group)
+{
+	char *processes, *p, *q, *kind;
+
+	/* the file is empty if there are no processes */
+	if ((processes = cg_get_string(CONTROLLER_CPU, "cgroup.procs", false)) == NULL)
+		return;
+
+	/* the file has one process ID per line */
+	p = processes;
+	while ((q = strchr(p, '\n')) != NULL)
+	{
+		*q = '\0';
+
+		if ((kind = process_kind((pid_t) atoi(p))) != NULL)
+		{
+			if (strncmp(kind, title, strlen(title)) == 0)
+				(void) cg_move_to_group(group, (pid_t) atoi(p));
+
+			pfree(kind);
+		}
+
+		p = q + 1;
+	}
+
+	pfree(processes);
+}
+
+/*
+ * All groups: those from "pg_cgroups.groups" and those requested
+ * by other extensions, as a palloc'ed comma separated list.
+ */
+char *
+group_list(void)
+{
+	if (extension_groups == NULL)
+		return pstrdup(groups ? groups : "");
+
+	if (groups == NULL || groups[0] == '\0')
+		return pstrdup(extension_groups);
+
+	return psprintf("%s, %s", groups, extension_groups);
+}
+
+/*
+ * Check if a group is defined in "pg_cgroups.groups"
+ * or was requested by another extension.
+ */
+bool
+group_exists(char * const name)
+{
+	char *list, *freeme, *entry;
+	bool found = false;
+
+	freeme = list = group_list();
+	while ((entry = next_group(&list)) != NULL)
+		if (strcmp(entry, name) == 0)
+		{
+			found = true;
+			break;
+		}
+
+	pfree(freeme);
+
+	return found;
+}
+
+/*
+ * Freeze or thaw all processes in a group.
+ * Frozen processes don't run until the group is thawed.
+ */
+void
+freeze_group(char * const name, bool freeze)
+{
+	if (!cg_has_controller(CONTROLLER_FREEZER))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("the \"freezer\" controller is not available"),
+				 errhint("Add the \"freezer\" controller to the \"/postgres\" control group as described in the pg_cgroup documentation.")));
+
+	cg_set_group_string(CONTROLLER_FREEZER, name, "freezer.state",
+						freeze ? "FROZEN" : "THAWED");
+}
+
+/* freeze or thaw all groups in a list that has passed group_list_check() */
+void
+freeze_group_list(char * const list, bool freeze)
+{
+	char *copy = pstrdup(list), *p = copy, *name;
+
+	while ((name = next_group(&p)) != NULL)
+		freeze_group(name, freeze);
+
+	pfree(copy);
+}
+
+/* make sure that the monitor leaves no groups frozen */
+void
+thaw_on_exit(int code, Datum arg)
+{
+	if (policy_frozen != NULL)
+		freeze_group_list(policy_frozen, false);
+}
+
+/*
+ * Freeze the groups in "pg_cgroups.freeze_groups" if memory usage
+ * exceeds "pg_cgroups.freeze_threshold" and thaw them when it drops
+ * below "pg_cgroups.thaw_threshold".  To keep the frozen processes
+ * from holding their locks forever, groups are thawed after
+ * "pg_cgroups.max_freeze_time" and not frozen again until memory
+ * usage has dropped below the thaw threshold.
+ * This is called by the monitor after each sample with the memory usage
+ * without inactive file system cache and the limit (-1 if unlimited).
+ */
+void
+freeze_policy(int64_t usage, int64_t limit)
+{
+	static bool exit_callback = false;
+	int percent;
+
+	if (!cg_has_controller(CONTROLLER_FREEZER))
+		return;
+
+	if (!exit_callback)
+	{
+		on_proc_exit(thaw_on_exit, (Datum) 0);
+		exit_callback = true;
+	}
+
+	/* if the list of groups has changed, start from scratch */
+	if (policy_frozen != NULL && strcmp(policy_frozen, freeze_groups) != 0)
+	{
+		freeze_group_list(policy_frozen, false);
+		pfree(policy_frozen);
+		policy_frozen = NULL;
+		policy_timed_out = false;
+	}
+
+	if (limit <= 0)
+		percent = 0;
+	else
+		percent = (int) (usage * 100 / limit);
+
+	if (policy_frozen == NULL)
+	{
+		if (policy_timed_out && percent < thaw_threshold)
+			policy_timed_out = false;
+
+		if (*freeze_groups == '\0' || policy_timed_out
+			|| percent < freeze_threshold)
+			return;
+
+		ereport(LOG,
+				(errmsg("freezing groups \"%s\"", freeze_groups),
+				 errdetail("Memory usage is %d%% of the memory limit.", percent)));
+
+		policy_frozen = MemoryContextStrdup(TopMemoryContext, freeze_groups);
+		policy_freeze_time = GetCurrentTimestamp();
+		freeze_group_list(policy_frozen, true);
+	}
+	else
+	{
+		if (percent < thaw_threshold)
+			ereport(LOG,
+					(errmsg("thawing groups \"%s\"", policy_frozen),
+					 errdetail("Memory usage is %d%% of the memory limit.", percent)));
+		else if (TimestampDifferenceExceeds(policy_freeze_time,
+											GetCurrentTimestamp(),
+											max_freeze_time * 1000))
+		{
+			ereport(LOG,
+					(errmsg("thawing groups \"%s\"", policy_frozen),
+					 errdetail("The groups were frozen for longer than \"pg_cgroups.max_freeze_time\".")));
+			policy_timed_out = true;
+		}
+		else
+			return;
+
+		freeze_group_list(policy_frozen, false);
+		pfree(policy_frozen);
+		policy_frozen = NULL;
+	}
+}
+
+/*
+ * SQL functions to freeze and thaw a group.
+ */
+
+Datum
+pg_cgroups_freeze(PG_FUNCTION_ARGS)
+{
+	char *name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+
+	if (!group_exists(name))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("group \"%s\" does not exist", name)));
+
+	if (current_group != NULL && strcmp(current_group, name) == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("cannot freeze the group of the current process")));
+
+	freeze_group(name, true);
+
+	PG_RETURN_VOID();
+}
+
+Datum
+pg_cgroups_thaw(PG_FUNCTION_ARGS)
+{
+	char *name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+
+	if (!group_exists(name))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("group \"%s\" does not exist", name)));
+
+	freeze_group(name, false);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * SQL function that returns the number of processes, the limit and the
+ * number of times that the limit prevented a fork for the cluster's
+ * control group (with a NULL group name) and all groups.
+ */
+Datum
+pg_cgroups_processes(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	char **names;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		TupleDesc tupdesc;
+		char *list, *name;
+		int count = 0;
+
+		if (!cg_has_controller(CONTROLLER_PIDS))
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("the \"pids\" controller is not available"),
+					 errhint("Add the \"pids\" controller to the \"/postgres\" control group as described in the pg_cgroup documentation.")));
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		/* there cannot be more groups than characters in the list */
+		list = group_list();
+		names = palloc(sizeof(char *) * (strlen(list) + 2));
+		names[count++] = NULL;
+		while ((name = next_group(&list)) != NULL)
+			names[count++] = name;
+
+		funcctx->max_calls = count;
+		funcctx->user_fctx = names;
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	names = (char **) funcctx->user_fctx;
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		char *name = names[funcctx->call_cntr], *current, *max, *events;
+		Datum values[4];
+		bool nulls[4] = {false, false, false, false};
+		HeapTuple tuple;
+
+		if (name == NULL)
+		{
+			nulls[0] = true;
+			current = cg_get_string(CONTROLLER_PIDS, "pids.current", false);
+			max = cg_get_string(CONTROLLER_PIDS, "pids.max", false);
+			events = cg_get_string(CONTROLLER_PIDS, "pids.events", false);
+		}
+		else
+		{
+			values[0] = CStringGetTextDatum(name);
+			current = cg_get_group_string(CONTROLLER_PIDS, name, "pids.current", false);
+			max = cg_get_group_string(CONTROLLER_PIDS, name, "pids.max", false);
+			events = cg_get_group_string(CONTROLLER_PIDS, name, "pids.events", false);
+		}
+
+		values[1] = Int64GetDatum(strtoll(current, NULL, 10));
+
+		/* "max" means no limit */
+		if (strncmp(max, "max", 3) == 0)
+			nulls[2] = true;
+		else
+			values[2] = Int64GetDatum(strtoll(max, NULL, 10));
+
+		values[3] = Int64GetDatum(Max(cg_stat_value(events, "max"), 0));
+
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * Sum up the values for an operation like "Read" over all devices
+ * in the contents of a file like "blkio.throttle.io_serviced",
+ * which consists of lines of the form "major:minor operation value".
+ */
+int64_t
+sum_io_stat(char * const stat, char * const operation)
+{
+	char *p = stat;
+	size_t len = strlen(operation);
+	int64_t sum = 0;
+
+	while (p != NULL && *p != '\0')
+	{
+		char *op = strchr(p, ' '), *eol = strchr(p, '\n');
+
+		if (eol == NULL)
+			eol = p + strlen(p);
+
+		if (op != NULL && op < eol
+			&& strncmp(op + 1, operation, len) == 0 && op[len + 1] == ' ')
+			sum += strtoll(op + len + 2, NULL, 10);
+
+		if ((p = strchr(p, '\n')) != NULL)
+			++p;
+	}
+
+	return sum;
+}
+
+/*
+ * Read a blkio statistics file like "blkio.throttle.io_serviced" for the
+ * cluster including its groups.  Older kernels like the 3.10 kernel of
+ * RHEL 7 have no "_recursive" files, so then we append the files of the
+ * groups to that of the cluster, which is fine for adding up the lines.
+ * Returns a palloc'ed string, or NULL if there are no statistics.
+ */
+char *
+cluster_io_stat(char * const parameter)
+{
+	char *recursive = psprintf("%s_recursive", parameter);
+	char *result, *stat, *list, *name;
+
+	result = cg_get_string(CONTROLLER_BLKIO, recursive, true);
+	pfree(recursive);
+	if (result != NULL)
+		return result;
+
+	if ((result = cg_get_string(CONTROLLER_BLKIO, parameter, true)) == NULL)
+		return NULL;
+
+	list = group_list();
+	while ((name = next_group(&list)) != NULL)
+	{
+		if ((stat = cg_get_group_string(CONTROLLER_BLKIO, name, parameter, true)) == NULL)
+			continue;
+
+		result = psprintf("%s\n%s", result, stat);
+		pfree(stat);
+	}
+
+	return result;
+}
+
+/*
+ * SQL function that returns the bytes and I/O operations read and written
+ * by the cluster (with a NULL group name, including the groups) and
+ * by each group.
+ */
+Datum
+pg_cgroups_io_stat(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	char **names;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		TupleDesc tupdesc;
+		char *list, *name;
+		int count = 0;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		/* there cannot be more groups than characters in the list */
+		list = group_list();
+		names = palloc(sizeof(char *) * (strlen(list) + 2));
+		names[count++] = NULL;
+		while ((name = next_group(&list)) != NULL)
+			names[count++] = name;
+
+		funcctx->max_calls = count;
+		funcctx->user_fctx = names;
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	names = (char **) funcctx->user_fctx;
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		char *name = names[funcctx->call_cntr], *bytes, *ops;
+		Datum values[5];
+		bool nulls[5] = {false, false, false, false, false};
+		HeapTuple tuple;
+
+		if (name == NULL)
+		{
+			nulls[0] = true;
+			bytes = cluster_io_stat("blkio.throttle.io_service_bytes");
+			ops = cluster_io_stat("blkio.throttle.io_serviced");
+		}
+		else
+		{
+			values[0] = CStringGetTextDatum(name);
+			bytes = cg_get_group_string(CONTROLLER_BLKIO, name, "blkio.throttle.io_service_bytes", false);
+			ops = cg_get_group_string(CONTROLLER_BLKIO, name, "blkio.throttle.io_serviced", false);
+		}
+
+		/* without statistics, the values are NULL */
+		values[1] = Int64GetDatum(sum_io_stat(bytes, "Read"));
+		values[2] = Int64GetDatum(sum_io_stat(bytes, "Write"));
+		values[3] = Int64GetDatum(sum_io_stat(ops, "Read"));
+		values[4] = Int64GetDatum(sum_io_stat(ops, "Write"));
+		nulls[1] = nulls[2] = (bytes == NULL);
+		nulls[3] = nulls[4] = (ops == NULL);
+
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * Create a group for another extension and set its limits.
+ * See "pg_cgroups_api.h".
+ */
+void
+pg_cgroups_api_request_group(const char *name, const PgCgroupsLimits *limits)
+{
+	char value[25];	/* long enough for an int64 */
+
+	/* only the postmaster can create groups */
+	if (!process_shared_preload_libraries_in_progress)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("groups can only be requested while \"shared_preload_libraries\" are loaded")));
+
+	if (!valid_group_name((char *) name))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid group name \"%s\"", name),
+				 errdetail("Group names must consist of up to %d lower case letters, digits and underscores.",
+						   MAX_GROUP_NAME)));
+
+	if (limits != NULL && limits->version != PG_CGROUPS_API_VERSION)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("unsupported pg_cgroups API version %d", limits->version),
+				 errdetail("This version of pg_cgroups supports API version %d.",
+						   PG_CGROUPS_API_VERSION)));
+
+	if (!group_exists((char *) name))
+	{
+		cg_create_group((char *) name);
+
+		if (extension_groups == NULL)
+			extension_groups = MemoryContextStrdup(TopMemoryContext, name);
+		else
+		{
+			char *list = psprintf("%s, %s", extension_groups, name);
+
+			pfree(extension_groups);
+			extension_groups = MemoryContextStrdup(TopMemoryContext, list);
+			pfree(list);
+		}
+	}
+
+	if (limits == NULL)
+		return;
+
+	if (limits->memory_limit != -1)
+	{
+		snprintf(value, 25, INT64_FORMAT, (int64_t) limits->memory_limit * 1024 * 1024);
+		cg_set_group_string(CONTROLLER_MEMORY, (char *) name, "memory.limit_in_bytes", value);
+	}
+
+	if (limits->cpu_share != -1)
+	{
+		/* the kernel does not accept quotas below 1 ms */
+		if (limits->cpu_share < 1000)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("CPU share %d for group \"%s\" is too small", limits->cpu_share, name),
+					 errdetail("The CPU share must be at least 1000.")));
+
+		/* groups have the default period of 100000 */
+		snprintf(value, 25, "%d", limits->cpu_share);
+		cg_set_group_string(CONTROLLER_CPU, (char *) name, "cpu.cfs_quota_us", value);
+	}
+
+	if (limits->max_processes != -1)
+	{
+		if (!cg_has_controller(CONTROLLER_PIDS))
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("the \"pids\" controller is not available"),
+					 errhint("Add the \"pids\" controller to the \"/postgres\" control group as described in the pg_cgroup documentation.")));
+
+		if (limits->max_processes < 1)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("process limit %d for group \"%s\" is too small", limits->max_processes, name),
+					 errdetail("The limit must be at least 1.")));
+
+		snprintf(value, 25, "%d", limits->max_processes);
+		cg_set_group_string(CONTROLLER_PIDS, (char *) name, "pids.max", value);
+	}
+
+	if (limits->io_weight != -1)
+	{
+		if (io_weight_param == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("the I/O scheduler does not support weights")));
+
+		if (!io_weight_valid(limits->io_weight))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("I/O weight %d for group \"%s\" is out of range", limits->io_weight, name),
+					 errdetail("The weight must be between %d and 1000.", (int) min_io_weight)));
+
+		snprintf(value, 25, "%d", limits->io_weight);
+		cg_set_group_string(CONTROLLER_BLKIO, (char *) name, io_weight_param, value);
+	}
+}
+
+/*
+ * Move the calling process to a group, or back to the cluster's
+ * control group if "name" is NULL.  See "pg_cgroups_api.h".
+ */
+bool
+pg_cgroups_api_join_group(const char *name)
+{
+	if (name != NULL && !group_exists((char *) name))
+	{
+		ereport(WARNING,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("group \"%s\" does not exist", name)));
+		return false;
+	}
+
+	if (!cg_move_to_group((char *) name, MyProcPid))
+	{
+		ereport(WARNING,
+				(errcode(ERRCODE_SYSTEM_ERROR),
+				 errmsg("cannot move process %d to group \"%s\"",
+						MyProcPid, name ? name : "")));
+		return false;
+	}
+
+	if (current_group != NULL)
+		pfree(current_group);
+	current_group = (name == NULL) ? NULL
+						: MemoryContextStrdup(TopMemoryContext, name);
+
+	return true;
+}
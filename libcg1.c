@@ -10,6 +10,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <dirent.h>
 #include <inttypes.h>
 #include <mntent.h>
 #include <stdio.h>
@@ -17,6 +18,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <unistd.h>
 
 #include "pg_cgroups.h"
@@ -34,23 +36,49 @@
  * static variables
  */
 
-/* structure for information about cgroup controllers */
+/*
+ * Structure for information about cgroup controllers.
+ * If an optional controller is not set up, "init" is false
+ * and the controller is not used.
+ * Child groups are not created for controllers without "groups".
+ */
 static struct {
 	char *name;
+	bool optional;
+	bool groups;
 	bool init;
 	char *mountpoint;
 } cgctl[MAX_CONTROLLERS] = {
-	{"memory", false, NULL},
-	{"cpu", false, NULL},
-	{"blkio", false, NULL},
-	{"cpuset", false, NULL}
+	{"memory", false, true, false, NULL},
+	{"cpu", false, true, false, NULL},
+	{"blkio", false, true, false, NULL},
+	{"cpuset", false, false, false, NULL},
+	{"freezer", true, true, false, NULL},
+	{"pids", true, true, false, NULL},
+	{"hugetlb", true, false, false, NULL},
+	{"net_cls", true, true, false, NULL},
+	{"net_prio", true, true, false, NULL}
 };
 /* postmaster PID */
 static pid_t postmaster_pid;
 
+/*
+ * Directory that takes the place of "/" for the kernel interfaces
+ * in "/proc" and "/sys".  This is empty, except when testing
+ * with a simulated control group file system.
+ */
+static char *system_root = "";
+
+/* called after each parameter that we write */
+cg_write_hook_type cg_write_hook = NULL;
+
 /* default values for the parameters */
 static char *def_cpus;
 static char *def_memory_nodes;
+static int def_swappiness = 60;
+
+/* false if the online CPUs or memory nodes changed since "/postgres" was set */
+static bool cpuset_extended = true;
 
 /*
  * function prototypes
@@ -59,9 +87,13 @@ static char *def_memory_nodes;
 static void check_controllers(void);
 static void get_mountpoints(void);
 static char * const get_online(char * const what);
+static char *read_sys_file(char * const path);
 static void cg_write_string(int controller, char * const cgroup, char * const parameter, char * const value);
-static char *cg_read_string(int controller, char * const cgroup, char * const parameter, bool ignore_errors);
+static bool fake_memsw_ok(int controller, char * const cgroup, char * const parameter, char * const value);
 static void cg_move_process(char * const cgroup, char * const process, bool silent);
+static bool shared_hierarchy(int controller, bool groups);
+static int make_cgroup_dir(char * const path);
+static void remove_cgroup_dir(char * const path);
 static void on_exit_callback(int code, Datum arg);
 
 /*
@@ -73,17 +105,18 @@ void
 check_controllers()
 {
 	FILE *cgfile;
-	char *line = NULL;
+	char *line = NULL, *path;
 	size_t size = 0;
 	int i, len;
 
 	errno = 0;
 
 	/* check if all cgroup controllers exist */
-	if ((cgfile = AllocateFile("/proc/cgroups", "r")) == NULL) {
+	path = system_path("/proc/cgroups");
+	if ((cgfile = AllocateFile(path, "r")) == NULL) {
 		ereport(FATAL,
 				(errcode(ERRCODE_SYSTEM_ERROR),
-				 errmsg("cannot open \"/proc/cgroups\": %m"),
+				 errmsg("cannot open \"%s\": %m", path),
 				 errhint("Make sure that Linux Control Groups are supported by the kernel and activated.")));
 	}
 
@@ -117,13 +150,14 @@ check_controllers()
 	if (errno)
 		ereport(FATAL,
 				(errcode(ERRCODE_SYSTEM_ERROR),
-				 errmsg("error reading from \"/proc/cgroups\": %m")));
+				 errmsg("error reading from \"%s\": %m", path)));
 
 	FreeFile(cgfile);
+	pfree(path);
 
-	/* check that all controllers are there */
+	/* check that all required controllers are there */
 	for (i=0; i<MAX_CONTROLLERS; ++i)
-		if (!cgctl[i].init)
+		if (!cgctl[i].init && !cgctl[i].optional)
 			ereport(FATAL,
 					(errcode(ERRCODE_SYSTEM_ERROR),
 					 errmsg("cgroup controller \"%s\" is not defined", cgctl[i].name),
@@ -142,10 +176,11 @@ get_mountpoints()
 	struct stat statbuf;
 
 	/* open /proc/mounts, which contains the mounted file systems */
-	if ((mntfile = AllocateFile("/proc/mounts", "r")) == NULL)
+	fname = system_path("/proc/mounts");
+	if ((mntfile = AllocateFile(fname, "r")) == NULL)
 		ereport(FATAL,
 				(errcode(ERRCODE_SYSTEM_ERROR),
-				 errmsg("cannot open \"/proc/mounts\": %m"),
+				 errmsg("cannot open \"%s\": %m", fname),
 				 errdetail("There is something wrong with your Linux operating system.")));
 
 	/* loop through all mounted file systems */
@@ -165,12 +200,12 @@ get_mountpoints()
 
 			/* if any of the options match, set the mount point */
 			for (i=0; i<MAX_CONTROLLERS; ++i)
-				if (strncmp(p1, cgctl[i].name, len) == 0
+				if (cgctl[i].init && strncmp(p1, cgctl[i].name, len) == 0
 					&& (p1[len] == ',' || p1[len] == '\0'))
 				{
 					cgctl[i].mountpoint = MemoryContextStrdup(
 												TopMemoryContext,
-												mnt->mnt_dir);
+												system_path(mnt->mnt_dir));
 					break;
 				}
 
@@ -179,10 +214,36 @@ get_mountpoints()
 	}
 
 	FreeFile(mntfile);
+	pfree(fname);
 
 	/* check that all cgroups are properly set up */
 	for (i=0; i<MAX_CONTROLLERS; ++i)
 	{
+		if (!cgctl[i].init)
+			continue;
+
+		/* optional controllers are only used if they are set up */
+		if (cgctl[i].optional)
+		{
+			if (cgctl[i].mountpoint != NULL)
+			{
+				fname = palloc(strlen(cgctl[i].mountpoint) + 10);
+				sprintf(fname, "%s/postgres", cgctl[i].mountpoint);
+				if (stat(fname, &statbuf) == -1 || !S_ISDIR(statbuf.st_mode))
+					cgctl[i].init = false;
+				pfree(fname);
+			}
+			else
+				cgctl[i].init = false;
+
+			if (!cgctl[i].init)
+				ereport(LOG,
+						(errmsg("cgroup controller \"%s\" is not used", cgctl[i].name),
+						 errdetail("There is no control group \"/postgres\" for the controller.")));
+
+			continue;
+		}
+
 		if (cgctl[i].mountpoint == NULL)
 			ereport(FATAL,
 					(errcode(ERRCODE_SYSTEM_ERROR),
@@ -213,9 +274,9 @@ const get_online(char * const what)
 	int fd;
 	ssize_t bytes, len;
 
-	len = strlen(what) + 28;
+	len = strlen(system_root) + strlen(what) + 28;
 	path = palloc(len);
-	snprintf(path, len, "/sys/devices/system/%s/online", what);
+	snprintf(path, len, "%s/sys/devices/system/%s/online", system_root, what);
 
 	errno = 0;
 
@@ -256,6 +317,34 @@ const get_online(char * const what)
 	return value;
 }
 
+/*
+ * Read a short file from "/sys" and remove the trailing newline.
+ * Returns a palloc'ed value or NULL if the file cannot be read.
+ */
+char *
+read_sys_file(char * const path)
+{
+	char buf[100];
+	ssize_t bytes;
+	int fd;
+
+	if ((fd = OpenTransFile(path, O_RDONLY)) == -1)
+		return NULL;
+
+	bytes = read(fd, buf, sizeof(buf) - 1);
+
+	CloseTransientFile(fd);
+
+	if (bytes <= 0)
+		return NULL;
+
+	buf[bytes] = '\0';
+	if (buf[bytes - 1] == '\n')
+		buf[bytes - 1] = '\0';
+
+	return pstrdup(buf);
+}
+
 /*
  * Write a control group parameter.
  */
@@ -272,6 +361,16 @@ cg_write_string(int controller, char * const cgroup, char * const parameter, cha
 			"%s/%s/%s",
 			cgctl[controller].mountpoint, cgroup, parameter);
 
+	/* on a simulated file system, reject what the kernel would reject */
+	if (system_root[0] != '\0'
+		&& !fake_memsw_ok(controller, cgroup, parameter, value))
+	{
+		errno = EINVAL;
+		ereport(ERROR,
+				(errcode(ERRCODE_SYSTEM_ERROR),
+				 errmsg("error writing file \"%s\": %m", path)));
+	}
+
 	errno = 0;
 
 	fd = OpenTransFile(path, O_WRONLY | O_TRUNC);
@@ -294,6 +393,78 @@ cg_write_string(int controller, char * const cgroup, char * const parameter, cha
 	pfree(path);
 
 	CloseTransientFile(fd);
+
+	if (cg_write_hook)
+		cg_write_hook(controller, cgroup, parameter, value);
+}
+
+/*
+ * The kernel refuses to set "memory.limit_in_bytes" above
+ * "memory.memsw.limit_in_bytes" and vice versa, so the order in which
+ * the two are changed matters.  Simulate that check for the test files,
+ * where a negative value means "unlimited".
+ */
+bool
+fake_memsw_ok(int controller, char * const cgroup, char * const parameter, char * const value)
+{
+	char *other;
+	int64_t mem, memsw;
+
+	if (controller != CONTROLLER_MEMORY)
+		return true;
+
+	if (strcmp(parameter, "memory.limit_in_bytes") == 0)
+	{
+		if ((other = cg_read_string(controller, cgroup, "memory.memsw.limit_in_bytes", true)) == NULL)
+			return true;
+		mem = strtoll(value, NULL, 10);
+		memsw = strtoll(other, NULL, 10);
+	}
+	else if (strcmp(parameter, "memory.memsw.limit_in_bytes") == 0)
+	{
+		if ((other = cg_read_string(controller, cgroup, "memory.limit_in_bytes", true)) == NULL)
+			return true;
+		mem = strtoll(other, NULL, 10);
+		memsw = strtoll(value, NULL, 10);
+	}
+	else
+		return true;
+
+	pfree(other);
+
+	if (mem < 0)
+		mem = INT64_MAX;
+	if (memsw < 0)
+		memsw = INT64_MAX;
+
+	return mem <= memsw;
+}
+
+/*
+ * Like cg_write_string, but return false instead of throwing an error
+ * if the kernel rejects the value.  "cg_write_hook" is not called.
+ */
+bool
+cg_try_write_string(int controller, char * const cgroup, char * const parameter, char * const value)
+{
+	char *path;
+	int fd;
+	bool result;
+
+	path = psprintf("%s/%s/%s", cgctl[controller].mountpoint, cgroup, parameter);
+
+	if ((fd = OpenTransFile(path, O_WRONLY | O_TRUNC)) == -1)
+	{
+		pfree(path);
+		return false;
+	}
+
+	result = (strlen(value) == 0 || write(fd, value, strlen(value)) >= 0);
+
+	CloseTransientFile(fd);
+	pfree(path);
+
+	return result;
 }
 
 /*
@@ -368,7 +539,10 @@ cg_move_process(char * const cgroup, char * const process, bool silent)
 
 	for (i=0; i<MAX_CONTROLLERS; ++i)
 	{
-		path = palloc(strlen(cgctl[i].mountpoint) + 30);
+		if (!cgctl[i].init || shared_hierarchy(i, false))
+			continue;
+
+		path = palloc(strlen(cgctl[i].mountpoint) + strlen(cgroup) + 8);
 		sprintf(path, "%s/%s/tasks", cgctl[i].mountpoint, cgroup);
 
 		fd = OpenTransFile(path, O_WRONLY);
@@ -405,6 +579,122 @@ cg_move_process(char * const cgroup, char * const process, bool silent)
 	}
 }
 
+/*
+ * Check if the controller is mounted together with one that comes earlier,
+ * like "net_cls,net_prio" with systemd.  Then the control groups already
+ * have been handled for the earlier controller.  If "groups" is true,
+ * only earlier controllers with child groups count.
+ */
+bool
+shared_hierarchy(int controller, bool groups)
+{
+	int i;
+
+	for (i=0; i<controller; ++i)
+		if (cgctl[i].init && (cgctl[i].groups || !groups)
+			&& strcmp(cgctl[i].mountpoint, cgctl[controller].mountpoint) == 0)
+			return true;
+
+	return false;
+}
+
+/*
+ * Create a control group directory like mkdir(2).
+ * The kernel populates a new control group with the parameter files,
+ * but in a simulated control group file system we have to copy
+ * them from the parent directory.
+ */
+int
+make_cgroup_dir(char * const path)
+{
+	char *parent, *p;
+	DIR *dir;
+	struct dirent *entry;
+
+	if (mkdir(path, 0700) == -1)
+		return -1;
+
+	if (system_root[0] == '\0')
+		return 0;
+
+	parent = pstrdup(path);
+	if ((p = strrchr(parent, '/')) != NULL)
+		*p = '\0';
+
+	if ((dir = AllocateDir(parent)) != NULL)
+	{
+		while ((entry = ReadDir(dir, parent)) != NULL)
+		{
+			char *from, *to, buf[1000];
+			int from_fd, to_fd;
+			ssize_t bytes;
+
+			if (entry->d_type != DT_REG)
+				continue;
+
+			from = psprintf("%s/%s", parent, entry->d_name);
+			to = psprintf("%s/%s", path, entry->d_name);
+
+			if ((to_fd = OpenTransFile(to, O_WRONLY | O_CREAT | O_TRUNC)) == -1)
+				ereport(ERROR,
+						(errcode(ERRCODE_SYSTEM_ERROR),
+						 errmsg("error opening file \"%s\" for writing: %m", to)));
+
+			/* the processes are not inherited */
+			if (strcmp(entry->d_name, "tasks") != 0
+				&& strcmp(entry->d_name, "cgroup.procs") != 0
+				&& (from_fd = OpenTransFile(from, O_RDONLY)) != -1)
+			{
+				while ((bytes = read(from_fd, buf, sizeof(buf))) > 0)
+					if (write(to_fd, buf, bytes) < 0)
+						ereport(ERROR,
+								(errcode(ERRCODE_SYSTEM_ERROR),
+								 errmsg("error writing file \"%s\": %m", to)));
+				CloseTransientFile(from_fd);
+			}
+
+			CloseTransientFile(to_fd);
+			pfree(from);
+			pfree(to);
+		}
+		FreeDir(dir);
+	}
+
+	pfree(parent);
+
+	return 0;
+}
+
+/*
+ * Remove a control group directory, ignoring errors.
+ * In a simulated control group file system, the parameter
+ * files have to be removed first.
+ */
+void
+remove_cgroup_dir(char * const path)
+{
+	DIR *dir;
+	struct dirent *entry;
+
+	if (system_root[0] != '\0' && (dir = AllocateDir(path)) != NULL)
+	{
+		while ((entry = ReadDir(dir, path)) != NULL)
+		{
+			char *file;
+
+			if (entry->d_type != DT_REG)
+				continue;
+
+			file = psprintf("%s/%s", path, entry->d_name);
+			(void) unlink(file);
+			pfree(file);
+		}
+		FreeDir(dir);
+	}
+
+	(void) rmdir(path);
+}
+
 void
 on_exit_callback(int code, Datum arg)
 {
@@ -419,23 +709,47 @@ on_exit_callback(int code, Datum arg)
 
 	/* we have to move the processes out of the control groups one by one */
 	p = processes;
-	while (*p != '\0')
+	while (p != NULL && *p != '\0')
 	{
-		q = strchr(p, '\n');
-		*q = '\0';
+		if ((q = strchr(p, '\n')) != NULL)
+			*q = '\0';
 		cg_move_process("postgres", p, true);
-		p = q + 1;
+		p = q ? (q + 1) : NULL;
 	}
 
-	pfree(processes);
+	if (processes)
+		pfree(processes);
 
-	/* remove the control groups */
+	/* remove the control groups, child groups first */
 	for (i=0; i<MAX_CONTROLLERS; ++i)
 	{
+		DIR *dir;
+		struct dirent *entry;
+
+		if (!cgctl[i].init || shared_hierarchy(i, false))
+			continue;
+
 		/* "postmaster_pid" is shorter than 30 digits */
 		path = palloc(strlen(cgctl[i].mountpoint) + 40);
 		sprintf(path, "%s/postgres/%d", cgctl[i].mountpoint, postmaster_pid);
-		(void) rmdir(path);
+
+		if ((dir = AllocateDir(path)) != NULL)
+		{
+			while ((entry = ReadDir(dir, path)) != NULL)
+			{
+				char *group;
+
+				if (entry->d_type != DT_DIR || entry->d_name[0] == '.')
+					continue;
+
+				group = psprintf("%s/%s", path, entry->d_name);
+				remove_cgroup_dir(group);
+				pfree(group);
+			}
+			FreeDir(dir);
+		}
+
+		remove_cgroup_dir(path);
 		pfree(path);
 	}
 }
@@ -446,6 +760,7 @@ on_exit_callback(int code, Datum arg)
 
 /*
  * Perform all the required initialization:
+ * - remember the directory that replaces "/" for "/proc" and "/sys"
  * - find the mount points for the control groups
  * - configure the "/postgres" cgroup
  * - create a cgroup for this PostgreSQL instance
@@ -455,12 +770,14 @@ on_exit_callback(int code, Datum arg)
  * - find out (and return) if the kernel has "memory.memsw.limit_in_bytes"
  */
 void
-cg_init(bool *cgroup_has_swap_param)
+cg_init(char * const root, bool *cgroup_has_swap_param)
 {
-	char *path, *cgroup, pid_s[30], *memsw;
+	char *path, *cgroup, pid_s[30], *memsw, *swappiness;
 	int i;
 
 	postmaster_pid = getpid();
+	if (root != NULL && root[0] != '\0')
+		system_root = MemoryContextStrdup(TopMemoryContext, root);
 	/* no process ID can be longer than 30 digits */
 	snprintf(pid_s, 30, "%d", postmaster_pid);
 
@@ -476,10 +793,13 @@ cg_init(bool *cgroup_has_swap_param)
 	/* create a control group for this cluster */
 	for (i=0; i<MAX_CONTROLLERS; ++i)
 	{
+		if (!cgctl[i].init || shared_hierarchy(i, false))
+			continue;
+
 		path = palloc(strlen(cgctl[i].mountpoint) + 31);
 		sprintf(path, "%s/postgres/%d", cgctl[i].mountpoint, postmaster_pid);
 
-		if (mkdir(path, 0700) == -1)
+		if (make_cgroup_dir(path) == -1)
 			ereport(FATAL,
 					(errcode(ERRCODE_SYSTEM_ERROR),
 					 errmsg("cannot create control group \"/postgres/%d\" for the \"%s\" controller: %m",
@@ -506,6 +826,14 @@ cg_init(bool *cgroup_has_swap_param)
 	/* set "cpu.cfs_period_us" to 100000 */
 	cg_write_string(CONTROLLER_CPU, cgroup, "cpu.cfs_period_us", "100000");
 
+	/* the new cgroup inherits "memory.swappiness" from its parent */
+	swappiness = cg_read_string(CONTROLLER_MEMORY, cgroup, "memory.swappiness", true);
+	if (swappiness)
+	{
+		def_swappiness = atoi(swappiness);
+		pfree(swappiness);
+	}
+
 	/*
 	 * On kernels configured without CONFIG_MEMCG_SWAP_ENABLED,
 	 * the "memory.memsw.limit_in_bytes" parameter is not available.
@@ -547,6 +875,396 @@ cg_set_int64(int controller, char * const parameter, int64_t value)
 	cg_set_string(controller, parameter, str);
 }
 
+/*
+ * Like cg_set_int64, but return false instead of throwing an error
+ * if the kernel rejects the value.
+ */
+bool
+cg_try_set_int64(int controller, char * const parameter, int64_t value)
+{
+	char *path, str[25];	/* long enough for an int64 */
+	int fd;
+	bool result;
+
+	snprintf(str, 25, "%" PRId64, value);
+
+	path = psprintf("%s/postgres/%d/%s",
+					cgctl[controller].mountpoint, postmaster_pid, parameter);
+
+	if ((fd = OpenTransFile(path, O_WRONLY | O_TRUNC)) == -1)
+		ereport(ERROR,
+				(errcode(ERRCODE_SYSTEM_ERROR),
+				 errmsg("error opening file \"%s\" for writing: %m", path)));
+
+	result = (write(fd, str, strlen(str)) >= 0);
+
+	CloseTransientFile(fd);
+	pfree(path);
+
+	return result;
+}
+
+/*
+ * Read a parameter of the cluster's control group.
+ * Returns a palloc'ed value, or NULL on error if "ignore_errors" is "true".
+ */
+char *
+cg_get_string(int controller, char * const parameter, bool ignore_errors)
+{
+	char cgroup[40];
+
+	/* "postmaster_pid" cannot exceed 30 digits */
+	sprintf(cgroup, "postgres/%d", postmaster_pid);
+
+	return cg_read_string(controller, cgroup, parameter, ignore_errors);
+}
+
+/*
+ * Get the path of a file in "/proc" or "/sys", which is below
+ * "pg_cgroups.system_root" if that is set.
+ * The result is palloc'ed.
+ */
+char *
+system_path(char * const path)
+{
+	return psprintf("%s%s", system_root, path);
+}
+
+/* check if an optional controller is available */
+bool
+cg_has_controller(int controller)
+{
+	return cgctl[controller].init;
+}
+
+/*
+ * Get the huge page sizes supported by the kernel in kB.
+ * At most "max" sizes are stored in "sizes", and the number
+ * of sizes is returned.
+ */
+int
+get_huge_page_sizes(int64_t *sizes, int max)
+{
+	DIR *dir;
+	struct dirent *entry;
+	char *path;
+	int count = 0;
+
+	path = system_path("/sys/kernel/mm/hugepages");
+	if ((dir = AllocateDir(path)) == NULL)
+	{
+		pfree(path);
+		return 0;
+	}
+
+	/* the directories are called "hugepages-<size>kB" */
+	while ((entry = ReadDir(dir, path)) != NULL
+		   && count < max)
+		if (strncmp(entry->d_name, "hugepages-", 10) == 0)
+			sizes[count++] = strtoll(entry->d_name + 10, NULL, 10);
+
+	FreeDir(dir);
+	pfree(path);
+
+	return count;
+}
+
+/*
+ * Get the default huge page size in kB from "/proc/meminfo".
+ * Returns 0 if huge pages are not supported.
+ */
+int64_t
+get_def_huge_page_size(void)
+{
+	FILE *meminfo;
+	char line[100], *path;
+	int64_t size = 0;
+
+	path = system_path("/proc/meminfo");
+	meminfo = AllocateFile(path, "r");
+	pfree(path);
+	if (meminfo == NULL)
+		return 0;
+
+	while (fgets(line, sizeof(line), meminfo) != NULL)
+		if (strncmp(line, "Hugepagesize:", 13) == 0)
+		{
+			size = strtoll(line + 13, NULL, 10);
+			break;
+		}
+
+	FreeFile(meminfo);
+
+	return size;
+}
+
+/*
+ * Get the name of a huge page size (in kB) like it appears in
+ * the names of the "hugetlb" parameters, for example "2MB".
+ * The result is palloc'ed.
+ */
+char *
+huge_page_size_name(int64_t size)
+{
+	if (size >= 1024 * 1024)
+		return psprintf(INT64_FORMAT "GB", size / (1024 * 1024));
+	else if (size >= 1024)
+		return psprintf(INT64_FORMAT "MB", size / 1024);
+	else
+		return psprintf(INT64_FORMAT "KB", size);
+}
+
+/*
+ * Get the beginning of the command line of a process, which
+ * contains the process title for PostgreSQL processes.
+ * Returns a palloc'ed string or NULL if the process does not exist.
+ */
+char *
+get_process_title(pid_t pid)
+{
+	char path[40];
+
+	/* "pid" cannot exceed 30 digits */
+	snprintf(path, 40, "/proc/%d/cmdline", (int) pid);
+
+	return read_sys_file(path);
+}
+
+/*
+ * Create a child group of the cluster's control group for all
+ * controllers that support groups.  This is called in the postmaster.
+ */
+void
+cg_create_group(char * const group)
+{
+	char *path;
+	int i;
+
+	for (i=0; i<MAX_CONTROLLERS; ++i)
+	{
+		if (!cgctl[i].init || !cgctl[i].groups || shared_hierarchy(i, true))
+			continue;
+
+		path = psprintf("%s/postgres/%d/%s",
+						cgctl[i].mountpoint, postmaster_pid, group);
+
+		if (make_cgroup_dir(path) == -1 && errno != EEXIST)
+			ereport(FATAL,
+					(errcode(ERRCODE_SYSTEM_ERROR),
+					 errmsg("cannot create control group \"/postgres/%d/%s\" for the \"%s\" controller: %m",
+							postmaster_pid, group, cgctl[i].name)));
+
+		pfree(path);
+	}
+}
+
+/*
+ * Move a process to a child group of the cluster's control group,
+ * or back to the cluster's control group if "group" is NULL.
+ * The cpuset is the same for all groups, so that is left alone.
+ * Returns false if the process could not be moved.
+ */
+bool
+cg_move_to_group(char * const group, pid_t pid)
+{
+	char *path, pid_s[30];
+	int i, fd;
+	bool result = true;
+
+	/* no process ID can be longer than 30 digits */
+	snprintf(pid_s, 30, "%d", (int) pid);
+
+	for (i=0; i<MAX_CONTROLLERS; ++i)
+	{
+		if (!cgctl[i].init || !cgctl[i].groups || shared_hierarchy(i, true))
+			continue;
+
+		if (group == NULL)
+			path = psprintf("%s/postgres/%d/tasks",
+							cgctl[i].mountpoint, postmaster_pid);
+		else
+			path = psprintf("%s/postgres/%d/%s/tasks",
+							cgctl[i].mountpoint, postmaster_pid, group);
+
+		if ((fd = OpenTransFile(path, O_WRONLY)) == -1)
+			result = false;
+		else
+		{
+			if (write(fd, pid_s, strlen(pid_s)) < 0)
+				result = false;
+			CloseTransientFile(fd);
+		}
+
+		pfree(path);
+	}
+
+	return result;
+}
+
+/*
+ * Open a parameter of the cluster's control group, or of a child group
+ * if "group" is not NULL, for reading.  The file descriptor is not
+ * managed by PostgreSQL, so it can be kept open, and the caller
+ * must close it.  Returns -1 if the parameter cannot be opened.
+ */
+int
+cg_open_parameter(int controller, char * const group, char * const parameter)
+{
+	char *path;
+	int fd;
+
+	if (group == NULL)
+		path = psprintf("%s/postgres/%d/%s",
+						cgctl[controller].mountpoint, postmaster_pid, parameter);
+	else
+		path = psprintf("%s/postgres/%d/%s/%s",
+						cgctl[controller].mountpoint, postmaster_pid, group, parameter);
+
+	fd = BasicOpenFile(path, O_RDONLY);
+
+	pfree(path);
+
+	return fd;
+}
+
+/*
+ * Write a parameter of a child group of the cluster's control group.
+ */
+void
+cg_set_group_string(int controller, char * const group, char * const parameter, char * const value)
+{
+	char *cgroup;
+
+	cgroup = psprintf("postgres/%d/%s", postmaster_pid, group);
+
+	cg_write_string(controller, cgroup, parameter, value);
+
+	pfree(cgroup);
+}
+
+/*
+ * Read a parameter of a child group of the cluster's control group.
+ * Returns a palloc'ed value, or NULL on error if "ignore_errors" is "true".
+ */
+char *
+cg_get_group_string(int controller, char * const group, char * const parameter, bool ignore_errors)
+{
+	char *cgroup, *result;
+
+	cgroup = psprintf("postgres/%d/%s", postmaster_pid, group);
+
+	result = cg_read_string(controller, cgroup, parameter, ignore_errors);
+
+	pfree(cgroup);
+
+	return result;
+}
+
+/*
+ * Find the value for "key" in the contents of a file like "cpu.stat"
+ * or "memory.stat", which consist of lines of the form "key value".
+ * Returns -1 if the key is not found.
+ */
+int64_t
+cg_stat_value(char * const stat, char * const key)
+{
+	char *p = stat;
+	size_t len = strlen(key);
+
+	while (p != NULL && *p != '\0')
+	{
+		if (strncmp(p, key, len) == 0 && p[len] == ' ')
+			return strtoll(p + len + 1, NULL, 10);
+
+		if ((p = strchr(p, '\n')) != NULL)
+			++p;
+	}
+
+	return -1;
+}
+
+/*
+ * Find the block device that contains "path".
+ * Block-I/O limits are set on whole disks, so if the file system
+ * is on a partition, the device of the disk is returned.
+ * The result is a palloc'ed string of the form "major:minor",
+ * or NULL if the device cannot be determined.
+ */
+char *
+get_disk_device(char * const path)
+{
+	struct stat statbuf;
+	char *device, *sysfile, *disk;
+
+	if (stat(path, &statbuf) == -1)
+		return NULL;
+
+	device = psprintf("%u:%u", major(statbuf.st_dev), minor(statbuf.st_dev));
+
+	/* partitions have a "partition" file, and their parent is the disk */
+	sysfile = psprintf("%s/sys/dev/block/%s/partition", system_root, device);
+	if (stat(sysfile, &statbuf) == -1)
+	{
+		pfree(sysfile);
+		return device;
+	}
+	pfree(sysfile);
+
+	sysfile = psprintf("%s/sys/dev/block/%s/../dev", system_root, device);
+	disk = read_sys_file(sysfile);
+	pfree(sysfile);
+
+	if (disk == NULL)
+		return device;
+
+	pfree(device);
+	return disk;
+}
+
+/*
+ * Read the online CPUs and memory nodes again to follow hotplug.
+ * Returns true if they have changed.
+ */
+bool
+cg_refresh_online(void)
+{
+	char *cpus = get_online("cpu"), *nodes = get_online("node");
+
+	if (strcmp(cpus, def_cpus) == 0 && strcmp(nodes, def_memory_nodes) == 0)
+	{
+		pfree(cpus);
+		pfree(nodes);
+
+		return false;
+	}
+
+	pfree(def_cpus);
+	pfree(def_memory_nodes);
+	def_cpus = cpus;
+	def_memory_nodes = nodes;
+	cpuset_extended = false;
+
+	return true;
+}
+
+/*
+ * Set the cpuset of the "/postgres" control group to the online CPUs
+ * and memory nodes, so that the cluster's cpuset can use hot-added ones.
+ * The kernel removes offline CPUs and nodes from all cpusets,
+ * but it doesn't add them when they come online.
+ * This does nothing unless they changed since the last call.
+ */
+void
+cg_extend_cpuset(void)
+{
+	if (cpuset_extended)
+		return;
+
+	cg_write_string(CONTROLLER_CPUSET, "postgres", "cpuset.cpus", def_cpus);
+	cg_write_string(CONTROLLER_CPUSET, "postgres", "cpuset.mems", def_memory_nodes);
+	cpuset_extended = true;
+}
+
 /* getter functions for the default values */
 char
 * const get_def_cpus(void)
@@ -559,3 +1277,9 @@ const get_def_memory_nodes(void)
 {
 	return def_memory_nodes;
 }
+
+int
+get_def_swappiness(void)
+{
+	return def_swappiness;
+}
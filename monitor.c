@@ -0,0 +1,574 @@
+#ifndef __linux__
+#error "Linux control groups are only available on Linux"
+#endif
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+
+#include "access/htup_details.h"
+#include "miscadmin.h"
+#include "optimizer/cost.h"
+#include "optimizer/planner.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "tcop/tcopprot.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+#include <errno.h>
+#include <limits.h>
+
+#include "pg_cgroups.h"
+
+/*
+ * The monitor is a background worker that periodically samples the
+ * cgroup counters into shared memory, so that backends can base
+ * decisions on them without reading the cgroup files themselves.
+ */
+
+PG_FUNCTION_INFO_V1(pg_cgroups_memory_stat);
+
+/* the latest sample, in shared memory */
+typedef struct
+{
+	slock_t		mutex;
+	TimestampTz	sample_time;	/* 0 if there is no sample yet */
+	int64_t		nr_periods;		/* counters from "cpu.stat" */
+	int64_t		nr_throttled;
+	double		throttle_ratio;	/* throttled periods in the last interval */
+	double		cores;			/* cores allowed by the quota, -1 if unlimited */
+	int64_t		memory_usage;	/* memory counters in bytes */
+	int64_t		memory_max_usage;
+	int64_t		memory_limit;	/* -1 if unlimited */
+	int64_t		memory_failcnt;
+	int64_t		anon;			/* from "memory.stat", -1 if not available */
+	int64_t		shmem;
+	int64_t		active_file;
+	int64_t		inactive_file;
+	int64_t		dirty;
+	int64_t		writeback;
+	int64_t		swap;
+} MonitorSample;
+
+static MonitorSample *sample = NULL;
+
+/* GUCs defined by the monitor */
+static int sample_interval = 1000;
+static bool parallel_gating = false;
+static double parallel_throttle_limit = 0.5;
+static int reclaim_interval = 0;
+static double reclaim_idle_cpu = 0.05;
+
+/* saved hook values */
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static planner_hook_type prev_planner_hook = NULL;
+
+/* set by the SIGHUP handler */
+static volatile sig_atomic_t got_sighup = false;
+
+/* static functions declarations */
+#if PG_VERSION_NUM >= 150000
+static void monitor_shmem_request(void);
+#endif
+static void monitor_shmem_startup(void);
+static void monitor_sighup(SIGNAL_ARGS);
+static void take_sample(void);
+static int64_t read_counter(char * const parameter);
+static void reclaim_policy(void);
+static int parallel_workers_allowed(void);
+#if PG_VERSION_NUM >= 130000
+static PlannedStmt *gating_planner(Query *parse, const char *query_string,
+								   int cursorOptions, ParamListInfo boundParams);
+#else
+static PlannedStmt *gating_planner(Query *parse, int cursorOptions,
+								   ParamListInfo boundParams);
+#endif
+
+/* entry point of the background worker */
+PGDLLEXPORT void monitor_main(Datum main_arg);
+
+/*
+ * Define the GUCs, request shared memory, install the hooks
+ * and register the background worker.
+ * This is called from _PG_init().
+ */
+void
+monitor_init(void)
+{
+	BackgroundWorker worker;
+
+	DefineCustomIntVariable(
+		"pg_cgroups.sample_interval",
+		"Interval between two samples of the cgroup counters.",
+		NULL,
+		&sample_interval,
+		1000,
+		100,
+		3600000,
+		PGC_SIGHUP,
+		GUC_UNIT_MS,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomBoolVariable(
+		"pg_cgroups.parallel_gating",
+		"Reduce parallel workers if the cluster is throttled by \"cpu_share\".",
+		NULL,
+		&parallel_gating,
+		false,
+		PGC_SIGHUP,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomRealVariable(
+		"pg_cgroups.parallel_throttle_limit",
+		"Fraction of throttled CPU periods above which no parallel workers are planned.",
+		"This is only used if \"pg_cgroups.parallel_gating\" is enabled.",
+		&parallel_throttle_limit,
+		0.5,
+		0.0,
+		1.0,
+		PGC_SIGHUP,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"pg_cgroups.reclaim_interval",
+		"Interval for reclaiming file system cache from the idle cluster.",
+		"0 disables reclaiming.",
+		&reclaim_interval,
+		0,
+		0,
+		INT_MAX / 1000,
+		PGC_SIGHUP,
+		GUC_UNIT_S,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomRealVariable(
+		"pg_cgroups.reclaim_idle_cpu",
+		"CPU usage (in cores) below which the cluster is considered idle.",
+		"This is only used if \"pg_cgroups.reclaim_interval\" is set.",
+		&reclaim_idle_cpu,
+		0.05,
+		0.0,
+		1000.0,
+		PGC_SIGHUP,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = monitor_shmem_request;
+#else
+	RequestAddinShmemSpace(MAXALIGN(sizeof(MonitorSample)));
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = monitor_shmem_startup;
+	prev_planner_hook = planner_hook;
+	planner_hook = gating_planner;
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+	worker.bgw_start_time = BgWorkerStart_PostmasterStart;
+	worker.bgw_restart_time = 10;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "pg_cgroups");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "monitor_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "pg_cgroups monitor");
+#if PG_VERSION_NUM >= 110000
+	snprintf(worker.bgw_type, BGW_MAXLEN, "pg_cgroups monitor");
+#endif
+
+	RegisterBackgroundWorker(&worker);
+}
+
+#if PG_VERSION_NUM >= 150000
+void
+monitor_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(MAXALIGN(sizeof(MonitorSample)));
+}
+#endif
+
+void
+monitor_shmem_startup(void)
+{
+	bool found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	sample = ShmemInitStruct("pg_cgroups monitor",
+							 sizeof(MonitorSample),
+							 &found);
+	if (!found)
+	{
+		memset(sample, 0, sizeof(MonitorSample));
+		SpinLockInit(&sample->mutex);
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+void
+monitor_sighup(SIGNAL_ARGS)
+{
+	int save_errno = errno;
+
+	got_sighup = true;
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
+/* read a memory counter of the cluster's control group */
+int64_t
+read_counter(char * const parameter)
+{
+	return strtoll(cg_get_string(CONTROLLER_MEMORY, parameter, false), NULL, 10);
+}
+
+/*
+ * Read the counters from the cgroup files and store them in shared memory.
+ * For "memory.stat", we use the "total_" values, which include child groups.
+ */
+void
+take_sample(void)
+{
+	char *stat, *quota, *period, *memstat;
+	int64_t nr_periods, nr_throttled, usage, max_usage, limit, failcnt;
+	int64_t anon, shmem, active_file, inactive_file, dirty, writeback, swap;
+	double cores = -1.0, ratio = 0.0;
+	TimestampTz now = GetCurrentTimestamp();
+
+	stat = cg_get_string(CONTROLLER_CPU, "cpu.stat", false);
+	nr_periods = cg_stat_value(stat, "nr_periods");
+	nr_throttled = cg_stat_value(stat, "nr_throttled");
+
+	quota = cg_get_string(CONTROLLER_CPU, "cpu.cfs_quota_us", false);
+	period = cg_get_string(CONTROLLER_CPU, "cpu.cfs_period_us", false);
+	if (strtoll(quota, NULL, 10) > 0 && strtoll(period, NULL, 10) > 0)
+		cores = (double) strtoll(quota, NULL, 10) / strtoll(period, NULL, 10);
+
+	usage = read_counter("memory.usage_in_bytes");
+	max_usage = read_counter("memory.max_usage_in_bytes");
+	failcnt = read_counter("memory.failcnt");
+
+	/* without a limit, the kernel reports a huge number */
+	limit = read_counter("memory.limit_in_bytes");
+	if (limit >= INT64CONST(0x7FFFFFFFFFFFF000) / 2)
+		limit = -1;
+
+	/* parse before taking the spinlock, which must only be held briefly */
+	memstat = cg_get_string(CONTROLLER_MEMORY, "memory.stat", false);
+	anon = cg_stat_value(memstat, "total_rss");
+	shmem = cg_stat_value(memstat, "total_shmem");
+	active_file = cg_stat_value(memstat, "total_active_file");
+	inactive_file = cg_stat_value(memstat, "total_inactive_file");
+	dirty = cg_stat_value(memstat, "total_dirty");
+	writeback = cg_stat_value(memstat, "total_writeback");
+	swap = cg_stat_value(memstat, "total_swap");
+
+	SpinLockAcquire(&sample->mutex);
+
+	/* the ratio is only meaningful if there is a previous sample */
+	if (sample->sample_time != 0 && nr_periods > sample->nr_periods)
+		ratio = (double) (nr_throttled - sample->nr_throttled)
+				/ (nr_periods - sample->nr_periods);
+
+	sample->sample_time = now;
+	sample->nr_periods = nr_periods;
+	sample->nr_throttled = nr_throttled;
+	sample->throttle_ratio = ratio;
+	sample->cores = cores;
+	sample->memory_usage = usage;
+	sample->memory_max_usage = max_usage;
+	sample->memory_limit = limit;
+	sample->memory_failcnt = failcnt;
+	sample->anon = anon;
+	sample->shmem = shmem;
+	sample->active_file = active_file;
+	sample->inactive_file = inactive_file;
+	sample->dirty = dirty;
+	sample->writeback = writeback;
+	sample->swap = swap;
+
+	SpinLockRelease(&sample->mutex);
+}
+
+void
+monitor_main(Datum main_arg)
+{
+	MemoryContext sample_context;
+
+	pqsignal(SIGHUP, monitor_sighup);
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	/* this is reset after each sample */
+	sample_context = AllocSetContextCreate(TopMemoryContext,
+										   "pg_cgroups monitor",
+										   ALLOCSET_DEFAULT_SIZES);
+
+	for (;;)
+	{
+		MemoryContext oldcontext;
+		int64_t usage, limit;
+		int rc;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (got_sighup)
+		{
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+
+			/* "auto" may have to be recomputed with the new parameters */
+			check_auto_memory_limit();
+		}
+
+		oldcontext = MemoryContextSwitchTo(sample_context);
+		take_sample();
+
+		/* inactive file system cache is easy to reclaim */
+		SpinLockAcquire(&sample->mutex);
+		usage = sample->memory_usage - Max(sample->inactive_file, 0);
+		limit = sample->memory_limit;
+		SpinLockRelease(&sample->mutex);
+
+		freeze_policy(usage, limit);
+		reclaim_policy();
+		oom_worker_policy();
+		place_archiver();
+		autovacuum_io_policy();
+		hotplug_policy();
+		verify_policy();
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(sample_context);
+
+		rc = WaitLatch(MyLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   sample_interval,
+					   PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+	}
+}
+
+/*
+ * Every "reclaim_interval", reclaim the inactive file system cache if the
+ * cluster used less than "reclaim_idle_cpu" cores since the last time.
+ * That makes the memory available to busier neighbors, which would
+ * otherwise have to wait for the kernel to reclaim it.
+ * The CPU usage is taken from "cpuacct.usage", so this only works if
+ * the "cpuacct" controller is mounted together with "cpu".
+ */
+void
+reclaim_policy(void)
+{
+	static TimestampTz last_time = 0;
+	static int64_t last_cpu_usage;
+	TimestampTz now = GetCurrentTimestamp();
+	char *value;
+	int64_t cpu_usage, inactive, reclaimed;
+
+	if (reclaim_interval == 0)
+	{
+		last_time = 0;
+		return;
+	}
+
+	if (last_time != 0
+		&& !TimestampDifferenceExceeds(last_time, now, reclaim_interval * 1000))
+		return;
+
+	if ((value = cg_get_string(CONTROLLER_CPU, "cpuacct.usage", true)) == NULL)
+		return;
+	cpu_usage = strtoll(value, NULL, 10);
+
+	/* "cpuacct.usage" is in nanoseconds, timestamps in microseconds */
+	if (last_time != 0
+		&& (double) (cpu_usage - last_cpu_usage) / 1000.0 / (now - last_time)
+			< reclaim_idle_cpu)
+	{
+		SpinLockAcquire(&sample->mutex);
+		inactive = sample->inactive_file;
+		SpinLockRelease(&sample->mutex);
+
+		if (inactive > 0
+			&& (reclaimed = reclaim_memory(inactive)) >= 1048576)
+			ereport(LOG,
+					(errmsg("reclaimed %ld MB of file system cache from the idle cluster",
+							(long) (reclaimed / 1048576))));
+	}
+
+	last_time = now;
+	last_cpu_usage = cpu_usage;
+}
+
+/*
+ * Compute how many parallel workers a Gather node may use, given
+ * the latest sample.  Returns INT_MAX if there is no reason to limit.
+ * If the cluster is already throttled, additional parallel workers
+ * will only compete for the same quota, so we refuse them if throttling
+ * exceeds "parallel_throttle_limit" and reduce them otherwise.
+ */
+int
+parallel_workers_allowed(void)
+{
+	TimestampTz sample_time;
+	double ratio, cores;
+	int allowed;
+
+	if (!parallel_gating || sample == NULL)
+		return INT_MAX;
+
+	SpinLockAcquire(&sample->mutex);
+	sample_time = sample->sample_time;
+	ratio = sample->throttle_ratio;
+	cores = sample->cores;
+	SpinLockRelease(&sample->mutex);
+
+	/* don't trust samples if the monitor is not working */
+	if (sample_time == 0
+		|| TimestampDifferenceExceeds(sample_time,
+									  GetCurrentTimestamp(),
+									  3 * sample_interval))
+		return INT_MAX;
+
+	if (ratio >= parallel_throttle_limit)
+		return 0;
+
+	if (cores < 0.0)
+		return INT_MAX;
+
+	/* the leader needs a core too */
+	allowed = (int) (cores * (1.0 - ratio)) - 1;
+
+	return Max(allowed, 0);
+}
+
+/*
+ * Planner hook that reduces "max_parallel_workers_per_gather"
+ * while the statement is planned.
+ */
+PlannedStmt *
+#if PG_VERSION_NUM >= 130000
+gating_planner(Query *parse, const char *query_string,
+			   int cursorOptions, ParamListInfo boundParams)
+#else
+gating_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
+#endif
+{
+	PlannedStmt *result;
+	int save_workers = max_parallel_workers_per_gather;
+
+	max_parallel_workers_per_gather = Min(save_workers,
+										  parallel_workers_allowed());
+
+	PG_TRY();
+	{
+#if PG_VERSION_NUM >= 130000
+		if (prev_planner_hook)
+			result = prev_planner_hook(parse, query_string, cursorOptions, boundParams);
+		else
+			result = standard_planner(parse, query_string, cursorOptions, boundParams);
+#else
+		if (prev_planner_hook)
+			result = prev_planner_hook(parse, cursorOptions, boundParams);
+		else
+			result = standard_planner(parse, cursorOptions, boundParams);
+#endif
+	}
+	PG_CATCH();
+	{
+		max_parallel_workers_per_gather = save_workers;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	max_parallel_workers_per_gather = save_workers;
+
+	return result;
+}
+
+/*
+ * SQL function that returns the memory counters from the latest sample.
+ * Values that are not available are NULL.
+ */
+Datum
+pg_cgroups_memory_stat(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupdesc;
+	MonitorSample copy;
+	Datum values[12];
+	bool nulls[12];
+	int64_t counters[11];
+	int i;
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	SpinLockAcquire(&sample->mutex);
+	copy = *sample;
+	SpinLockRelease(&sample->mutex);
+
+	if (copy.sample_time == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("no memory sample is available"),
+				 errhint("Make sure that the \"pg_cgroups monitor\" background worker is running.")));
+
+	values[0] = TimestampTzGetDatum(copy.sample_time);
+	nulls[0] = false;
+
+	counters[0] = copy.memory_usage;
+	counters[1] = copy.memory_max_usage;
+	counters[2] = copy.memory_limit;
+	counters[3] = copy.memory_failcnt;
+	counters[4] = copy.anon;
+	counters[5] = copy.shmem;
+	counters[6] = copy.active_file;
+	counters[7] = copy.inactive_file;
+	counters[8] = copy.dirty;
+	counters[9] = copy.writeback;
+	counters[10] = copy.swap;
+
+	for (i=0; i<lengthof(counters); ++i)
+	{
+		nulls[i + 1] = (counters[i] < 0);
+		values[i + 1] = Int64GetDatum(counters[i]);
+	}
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(tupdesc), values, nulls)));
+}
@@ -0,0 +1,463 @@
+#ifndef __linux__
+#error "Linux control groups are only available on Linux"
+#endif
+
+#include "postgres.h"
+
+#include "access/parallel.h"
+#include "miscadmin.h"
+#include "replication/walsender.h"
+#include "storage/fd.h"
+#include "storage/proc.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pg_cgroups.h"
+
+/*
+ * The OOM victim policy sets "oom_score_adj" of PostgreSQL processes by
+ * process kind and group, so that the kernel's OOM killer prefers
+ * processes whose death is cheap, like reporting backends, over
+ * processes whose death makes the postmaster reinitialize the cluster.
+ *
+ * - Processes that the postmaster starts get the value for "auxiliary"
+ *   when they are forked, using PostgreSQL's own PG_OOM_ADJUST_FILE and
+ *   PG_OOM_ADJUST_VALUE environment variables.
+ * - Client backends and WAL senders set their value during authentication
+ *   and when they change the group.
+ * - Parallel workers take the value of their leader when they restore
+ *   the leader's parameters at start.
+ * - The monitor sets the value of autovacuum workers.
+ *
+ * Without privileges, a process can only lower its value down to the value
+ * that the service manager started PostgreSQL with.
+ */
+
+#define OOM_FILE "/proc/self/oom_score_adj"
+
+/* no entry for a process kind or group */
+#define NO_SETTING INT_MIN
+
+/* process kinds that can have an entry in "pg_cgroups.oom_score_adj" */
+static const char * const oom_kinds[] = {
+	"auxiliary",
+	"client",
+	"walsender",
+	"autovacuum",
+	NULL
+};
+
+/* GUCs defined by the policy */
+static char *oom_score_adj = NULL;
+static char *group_oom_score_adj = NULL;
+
+/* the environment variables before we changed them */
+static char *orig_adjust_file = NULL;
+static char *orig_adjust_value = NULL;
+
+/* the value of backends without an entry, inherited from the postmaster */
+static int start_value = NO_SETTING;
+
+/* static functions declarations */
+static bool oom_score_adj_check(char **newval, void **extra, GucSource source);
+static void oom_score_adj_assign(const char *newval, void *extra);
+static bool group_oom_score_adj_check(char **newval, void **extra, GucSource source);
+static void group_oom_score_adj_assign(const char *newval, void *extra);
+static void oom_parallel_worker_policy(void);
+static int oom_setting(char * const list, const char * const kind);
+static int get_oom_score_adj(pid_t pid);
+static void set_oom_score_adj(pid_t pid, int value);
+static void restore_env(const char *name, char * const value);
+
+/*
+ * Define the GUCs.
+ * This is called from _PG_init().
+ */
+void
+oom_init(void)
+{
+	char *value;
+
+	/* remember how PostgreSQL was started */
+	if ((value = getenv("PG_OOM_ADJUST_FILE")) != NULL)
+		orig_adjust_file = MemoryContextStrdup(TopMemoryContext, value);
+	if ((value = getenv("PG_OOM_ADJUST_VALUE")) != NULL)
+		orig_adjust_value = MemoryContextStrdup(TopMemoryContext, value);
+
+	/*
+	 * Once we set PG_OOM_ADJUST_VALUE, the postmaster's children start
+	 * with the value for "auxiliary", so the value that backends would
+	 * have without pg_cgroups must be determined now: the original
+	 * PG_OOM_ADJUST_VALUE, which defaults to 0, or else the postmaster's.
+	 */
+	if (orig_adjust_file != NULL)
+		start_value = (orig_adjust_value != NULL) ? atoi(orig_adjust_value) : 0;
+	else
+		start_value = get_oom_score_adj(0);
+
+	DefineCustomStringVariable(
+		"pg_cgroups.oom_score_adj",
+		"OOM killer score adjustment of process kinds.",
+		"This is a comma separated list of \"kind value\" entries, where \"kind\" "
+		"is \"auxiliary\", \"client\", \"walsender\" or \"autovacuum\".",
+		&oom_score_adj,
+		"",
+		PGC_SIGHUP,
+		0,
+		oom_score_adj_check,
+		oom_score_adj_assign,
+		NULL
+	);
+
+	DefineCustomStringVariable(
+		"pg_cgroups.group_oom_score_adj",
+		"OOM killer score adjustment of client backends in groups.",
+		"This is a comma separated list of \"group value\" entries "
+		"and takes precedence over \"client\" in \"pg_cgroups.oom_score_adj\".",
+		&group_oom_score_adj,
+		"",
+		PGC_SIGHUP,
+		0,
+		group_oom_score_adj_check,
+		group_oom_score_adj_assign,
+		NULL
+	);
+}
+
+/*
+ * Check a comma separated list of "kind value" entries, where "value"
+ * is between -1000 and 1000.  Each kind can appear only once.
+ */
+bool
+oom_score_adj_check(char **newval, void **extra, GucSource source)
+{
+	char *p = pstrdup(*newval), *entry, *value, *end, *seen = pstrdup("");
+	long v;
+	int i;
+
+	while ((entry = next_group(&p)) != NULL)
+	{
+		if ((value = strchr(entry, ' ')) == NULL)
+		{
+			GUC_check_errdetail(
+				"Entry \"%s\" must have a space between kind and value.",
+				entry
+			);
+			return false;
+		}
+
+		*(value++) = '\0';
+		while (*value == ' ')
+			++value;
+
+		for (i=0; oom_kinds[i] != NULL; ++i)
+			if (strcmp(entry, oom_kinds[i]) == 0)
+				break;
+
+		if (oom_kinds[i] == NULL)
+		{
+			GUC_check_errdetail(
+				"Process kind \"%s\" is not \"auxiliary\", \"client\", \"walsender\" or \"autovacuum\".",
+				entry
+			);
+			return false;
+		}
+
+		if (oom_setting(seen, entry) != NO_SETTING)
+		{
+			GUC_check_errdetail(
+				"Process kind \"%s\" appears more than once.",
+				entry
+			);
+			return false;
+		}
+		seen = psprintf("%s%s 0,", seen, entry);
+
+		errno = 0;
+		v = strtol(value, &end, 10);
+		if (*end != '\0' || end == value || errno != 0 || v < -1000 || v > 1000)
+		{
+			GUC_check_errdetail(
+				"Value \"%s\" must be an integer between -1000 and 1000.",
+				value
+			);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Make the postmaster set the value for "auxiliary" in the processes it
+ * starts, and warn about values that the processes cannot set.
+ */
+void
+oom_score_adj_assign(const char *newval, void *extra)
+{
+	int i, value, current;
+
+	if (InitializingParallelWorker)
+	{
+		oom_parallel_worker_policy();
+		return;
+	}
+
+	/* the environment of the postmaster is inherited by its children */
+	if (MyProcPid != PostmasterPid)
+		return;
+
+	value = oom_setting((char *) newval, "auxiliary");
+	if (value == NO_SETTING)
+	{
+		restore_env("PG_OOM_ADJUST_FILE", orig_adjust_file);
+		restore_env("PG_OOM_ADJUST_VALUE", orig_adjust_value);
+	}
+	else
+	{
+		char str[12];
+
+		snprintf(str, 12, "%d", value);
+		setenv("PG_OOM_ADJUST_FILE", OOM_FILE, 1);
+		setenv("PG_OOM_ADJUST_VALUE", str, 1);
+	}
+
+	if ((current = get_oom_score_adj(0)) == NO_SETTING)
+		return;
+
+	for (i=0; oom_kinds[i] != NULL; ++i)
+	{
+		value = oom_setting((char *) newval, oom_kinds[i]);
+
+		if (value != NO_SETTING && value < current)
+			ereport(WARNING,
+					(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+					 errmsg("\"oom_score_adj\" %d for \"%s\" is lower than %d of the postmaster",
+							value, oom_kinds[i], current),
+					 errdetail("Only privileged processes can lower \"oom_score_adj\" below the value that PostgreSQL was started with."),
+					 errhint("Start PostgreSQL with a lower \"oom_score_adj\", for example with \"OOMScoreAdjust=-1000\" in the systemd service.")));
+	}
+}
+
+bool
+group_oom_score_adj_check(char **newval, void **extra, GucSource source)
+{
+	char *list, *name;
+
+	if (!check_group_settings(*newval))
+		return false;
+
+	list = group_list();
+	while ((name = next_group(&list)) != NULL)
+	{
+		int64_t value = group_setting(*newval, name);
+
+		if (value > 1000)
+		{
+			GUC_check_errdetail(
+				"The value for group \"%s\" must be between 0 and 1000.",
+				name
+			);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void
+group_oom_score_adj_assign(const char *newval, void *extra)
+{
+	if (InitializingParallelWorker)
+		oom_parallel_worker_policy();
+}
+
+/*
+ * Parallel workers don't go through authentication, but they restore
+ * the parameters of their leader when they start, which calls the assign
+ * hooks of the parameters that are set.  So if one of our parameters is
+ * set, we get here and give the worker the value of its leader.
+ */
+void
+oom_parallel_worker_policy(void)
+{
+	int leader;
+
+	if (MyProc->lockGroupLeader == NULL)
+		return;
+
+	if ((leader = get_oom_score_adj(MyProc->lockGroupLeader->pid)) != NO_SETTING)
+		set_oom_score_adj(0, leader);
+}
+
+/*
+ * Find the value for a kind in a list that has passed oom_score_adj_check().
+ * Returns NO_SETTING if there is no entry for the kind.
+ */
+int
+oom_setting(char * const list, const char * const kind)
+{
+	char *p = pstrdup(list), *freeme = p, *entry;
+	size_t len = strlen(kind);
+	int result = NO_SETTING;
+
+	while ((entry = next_group(&p)) != NULL)
+		if (strncmp(entry, kind, len) == 0 && entry[len] == ' ')
+		{
+			result = (int) strtol(entry + len, NULL, 10);
+			break;
+		}
+
+	pfree(freeme);
+
+	return result;
+}
+
+/*
+ * Read "oom_score_adj" of a process, 0 means the calling process.
+ * Returns NO_SETTING if the file cannot be read.
+ */
+int
+get_oom_score_adj(pid_t pid)
+{
+	char path[40], buf[12];
+	int fd;
+	ssize_t bytes;
+
+	if (pid == 0)
+		snprintf(path, 40, OOM_FILE);
+	else
+		snprintf(path, 40, "/proc/%d/oom_score_adj", (int) pid);
+
+	if ((fd = OpenTransientFile(path, O_RDONLY)) == -1)
+		return NO_SETTING;
+
+	bytes = read(fd, buf, sizeof(buf) - 1);
+	CloseTransientFile(fd);
+
+	if (bytes <= 0)
+		return NO_SETTING;
+	buf[bytes] = '\0';
+
+	return (int) strtol(buf, NULL, 10);
+}
+
+/*
+ * Set "oom_score_adj" of a process, 0 means the calling process.
+ * Errors are ignored: the process may have exited, or it may not be
+ * allowed to lower the value, which oom_score_adj_assign() warns about.
+ */
+void
+set_oom_score_adj(pid_t pid, int value)
+{
+	char path[40], buf[12];
+	int fd;
+
+	if (get_oom_score_adj(pid) == value)
+		return;
+
+	if (pid == 0)
+		snprintf(path, 40, OOM_FILE);
+	else
+		snprintf(path, 40, "/proc/%d/oom_score_adj", (int) pid);
+
+	if ((fd = OpenTransientFile(path, O_WRONLY)) == -1)
+		return;
+
+	snprintf(buf, 12, "%d", value);
+	if (write(fd, buf, strlen(buf)) != strlen(buf))
+		elog(DEBUG1, "cannot set \"oom_score_adj\" of process %d to %d: %m",
+			 (int) (pid == 0 ? MyProcPid : pid), value);
+	CloseTransientFile(fd);
+}
+
+/* set or unset an environment variable */
+void
+restore_env(const char *name, char * const value)
+{
+	if (value == NULL)
+		unsetenv(name);
+	else
+		setenv(name, value, 1);
+}
+
+/*
+ * Set "oom_score_adj" of a client backend or WAL sender, given its group.
+ * This is called during authentication and when the group changes.
+ */
+void
+oom_backend_policy(char * const group)
+{
+	int value = NO_SETTING;
+
+	if (am_walsender)
+		value = oom_setting(oom_score_adj, "walsender");
+	else
+	{
+		if (group != NULL)
+		{
+			int64_t setting = group_setting(group_oom_score_adj, group);
+
+			if (setting != -1)
+				value = (int) setting;
+		}
+
+		if (value == NO_SETTING)
+			value = oom_setting(oom_score_adj, "client");
+	}
+
+	/* without an entry, the process gets the value it would have without us */
+	if (value == NO_SETTING)
+		value = start_value;
+
+	if (value != NO_SETTING)
+		set_oom_score_adj(0, value);
+}
+
+/*
+ * Set "oom_score_adj" of autovacuum workers, which don't go through
+ * authentication.  The monitor calls this after each sample, before it
+ * moves processes out of the cluster's control group.
+ */
+void
+oom_worker_policy(void)
+{
+	char *processes, *p, *q, *kind;
+	int autovacuum;
+
+	if ((autovacuum = oom_setting(oom_score_adj, "autovacuum")) == NO_SETTING)
+		return;
+
+	/* the file is empty if there are no processes */
+	if ((processes = cg_get_string(CONTROLLER_CPU, "cgroup.procs", false)) == NULL)
+		return;
+
+	/* the file has one process ID per line */
+	p = processes;
+	while ((q = strchr(p, '\n')) != NULL)
+	{
+		pid_t pid;
+
+		*q = '\0';
+		pid = (pid_t) atoi(p);
+
+		if ((kind = process_kind(pid)) != NULL)
+		{
+			if (strncmp(kind, "autovacuum worker", 17) == 0)
+				set_oom_score_adj(pid, autovacuum);
+
+			pfree(kind);
+		}
+
+		p = q + 1;
+	}
+
+	pfree(processes);
+}
@@ -0,0 +1,155 @@
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION pg_cgroups" to load this file. \quit
+
+CREATE FUNCTION pg_cgroups_freeze(group_name text) RETURNS void
+   LANGUAGE c STRICT AS 'MODULE_PATHNAME';
+
+COMMENT ON FUNCTION pg_cgroups_freeze(text) IS
+   'stop all processes in a group until it is thawed';
+
+CREATE FUNCTION pg_cgroups_thaw(group_name text) RETURNS void
+   LANGUAGE c STRICT AS 'MODULE_PATHNAME';
+
+COMMENT ON FUNCTION pg_cgroups_thaw(text) IS
+   'resume all processes in a frozen group';
+
+CREATE FUNCTION pg_cgroups_processes(
+   OUT group_name text,
+   OUT processes bigint,
+   OUT max_processes bigint,
+   OUT fork_failures bigint
+) RETURNS SETOF record
+   LANGUAGE c AS 'MODULE_PATHNAME';
+
+COMMENT ON FUNCTION pg_cgroups_processes() IS
+   'number and limit of processes for the cluster and its groups';
+
+CREATE FUNCTION pg_cgroups_huge_pages(
+   OUT page_size text,
+   OUT usage bigint,
+   OUT max_usage bigint,
+   OUT huge_page_limit bigint,
+   OUT failures bigint
+) RETURNS SETOF record
+   LANGUAGE c AS 'MODULE_PATHNAME';
+
+COMMENT ON FUNCTION pg_cgroups_huge_pages() IS
+   'usage and limit of huge pages for the cluster';
+
+CREATE FUNCTION pg_cgroups_kernel_memory(
+   OUT memory_type text,
+   OUT usage bigint,
+   OUT max_usage bigint,
+   OUT memory_limit bigint,
+   OUT failures bigint
+) RETURNS SETOF record
+   LANGUAGE c AS 'MODULE_PATHNAME';
+
+COMMENT ON FUNCTION pg_cgroups_kernel_memory() IS
+   'usage and limit of kernel memory and TCP buffers for the cluster';
+
+CREATE FUNCTION pg_cgroups_memory_stat(
+   OUT sample_time timestamp with time zone,
+   OUT usage bigint,
+   OUT max_usage bigint,
+   OUT memory_limit bigint,
+   OUT failures bigint,
+   OUT anonymous bigint,
+   OUT shmem bigint,
+   OUT active_file bigint,
+   OUT inactive_file bigint,
+   OUT dirty bigint,
+   OUT writeback bigint,
+   OUT swap bigint
+) RETURNS record
+   LANGUAGE c AS 'MODULE_PATHNAME';
+
+COMMENT ON FUNCTION pg_cgroups_memory_stat() IS
+   'memory usage of the cluster from the latest sample';
+
+CREATE VIEW pg_cgroups_memory AS
+   SELECT * FROM pg_cgroups_memory_stat();
+
+CREATE FUNCTION pg_cgroups_reclaim(bytes bigint) RETURNS bigint
+   LANGUAGE c STRICT AS 'MODULE_PATHNAME';
+
+COMMENT ON FUNCTION pg_cgroups_reclaim(bigint) IS
+   'reclaim file system cache from the cluster';
+
+CREATE FUNCTION pg_cgroups_io_stat(
+   OUT group_name text,
+   OUT read_bytes bigint,
+   OUT write_bytes bigint,
+   OUT reads bigint,
+   OUT writes bigint
+) RETURNS SETOF record
+   LANGUAGE c AS 'MODULE_PATHNAME';
+
+COMMENT ON FUNCTION pg_cgroups_io_stat() IS
+   'block I/O of the cluster and its groups';
+
+CREATE TABLE pg_cgroups_schedule (
+   start_time time without time zone NOT NULL,
+   end_time   time without time zone NOT NULL,
+   parameter  text NOT NULL,
+   value      text NOT NULL,
+   PRIMARY KEY (start_time, end_time, parameter),
+   CONSTRAINT pg_cgroups_schedule_window_check
+      CHECK (start_time <> end_time),
+   CONSTRAINT pg_cgroups_schedule_parameter_check
+      CHECK (parameter LIKE 'pg\_cgroups.%')
+);
+
+COMMENT ON TABLE pg_cgroups_schedule IS
+   'settings for time windows, applied by the pg_cgroups scheduler';
+
+SELECT pg_catalog.pg_extension_config_dump('pg_cgroups_schedule', '');
+
+/*
+ * A window from 22:00 to 06:00 spans midnight.  If windows overlap,
+ * the setting from the window that started last wins.
+ */
+CREATE FUNCTION pg_cgroups_active_schedule(
+   time_of_day time without time zone DEFAULT localtime,
+   OUT parameter text,
+   OUT value text
+) RETURNS SETOF record
+   LANGUAGE sql STABLE AS
+$$SELECT DISTINCT ON (s.parameter) s.parameter, s.value
+FROM pg_cgroups_schedule AS s
+WHERE CASE WHEN s.start_time < s.end_time
+           THEN time_of_day >= s.start_time AND time_of_day < s.end_time
+           ELSE time_of_day >= s.start_time OR time_of_day < s.end_time
+      END
+ORDER BY s.parameter,
+         CASE WHEN s.start_time <= time_of_day
+              THEN time_of_day - s.start_time
+              ELSE time_of_day - s.start_time + interval '24 hours'
+         END$$;
+
+COMMENT ON FUNCTION pg_cgroups_active_schedule(time without time zone) IS
+   'settings of the time windows that are active at a time of day';
+
+CREATE FUNCTION pg_cgroups_verification(
+   OUT group_name text,
+   OUT parameter text,
+   OUT device text,
+   OUT expected text,
+   OUT observed text,
+   OUT drift_since timestamp with time zone,
+   OUT last_check timestamp with time zone,
+   OUT reapplied bigint
+) RETURNS SETOF record
+   LANGUAGE c AS 'MODULE_PATHNAME';
+
+COMMENT ON FUNCTION pg_cgroups_verification() IS
+   'control group parameters written by pg_cgroups and what the kernel reports';
+
+CREATE VIEW pg_cgroups_drift AS
+   SELECT group_name, parameter, device, expected, observed, drift_since, reapplied
+   FROM pg_cgroups_verification()
+   WHERE drift_since IS NOT NULL;
+
+REVOKE EXECUTE ON FUNCTION pg_cgroups_freeze(text) FROM PUBLIC;
+REVOKE EXECUTE ON FUNCTION pg_cgroups_thaw(text) FROM PUBLIC;
+REVOKE EXECUTE ON FUNCTION pg_cgroups_reclaim(bigint) FROM PUBLIC;
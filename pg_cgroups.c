@@ -4,14 +4,26 @@
 
 #include "postgres.h"
 #include "fmgr.h"
+#include "funcapi.h"
 
+#include "access/htup_details.h"
+#include "access/parallel.h"
+#include "access/xlog_internal.h"
 #include "miscadmin.h"
+#include "postmaster/autovacuum.h"
+#include "postmaster/bgwriter.h"
+#include "port/atomics.h"
 #include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
 #include "utils/guc.h"
+#include "utils/memutils.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -21,12 +33,20 @@
 
 PG_MODULE_MAGIC;
 
+PG_FUNCTION_INFO_V1(pg_cgroups_huge_pages);
+PG_FUNCTION_INFO_V1(pg_cgroups_kernel_memory);
+PG_FUNCTION_INFO_V1(pg_cgroups_reclaim);
+
 static char *pg_cgroups_version;
 
 /* GUCs defined by the module */
-static int memory_limit = -1;
+static char *memory_limit_setting = NULL;
 static int swap_limit = -1;
 static bool oom_killer = true;
+static char *memory_soft_limit = NULL;
+static int connection_memory = 8;
+static int page_cache_reserve = 1024;
+static int swappiness = -1;	/* set during module initialization */
 static char *read_bps_limit = NULL;
 static char *write_bps_limit = NULL;
 static char *read_iops_limit = NULL;
@@ -34,23 +54,129 @@ static char *write_iops_limit = NULL;
 static int cpu_share = -1;
 static char* cpus = NULL;	/* set during module initialization */
 static char* memory_nodes = NULL;	/* set during module initialization */
+static bool write_pacing = false;
+static int wal_write_reserve = 20;
+static bool derive_planner_settings = false;
+static int max_processes = -1;
+static int huge_page_limit = -1;
+static int kernel_memory_limit = -1;
+static int tcp_memory_limit = -1;
+static char *system_root = NULL;
 
 /* other static variables */
 static bool cgroup_has_swap_param = false;  /* set during module initialization */
-static int max_cpu_share = -1;	/* set during module initialization */
+static bool cgroup_has_kmem_param = false;  /* set during module initialization */
+static int memory_limit = -1;	/* "memory_limit_setting" in MB */
+static char *huge_page_param = NULL;	/* set during module initialization */
+
+/*
+ * Shared state of reclaim_memory(): the lock serializes the callers,
+ * and "memory_limit" is the value of "memory.limit_in_bytes" that the
+ * postmaster applied last, so that it can be restored.  The monitor
+ * also compares it with the automatic memory limit.
+ */
+typedef struct
+{
+	LWLock	   *lock;
+	pg_atomic_uint64 memory_limit;	/* in bytes, -1 if unlimited */
+} ReclaimShared;
+
+static ReclaimShared *reclaim = NULL;
+
+/* saved hook values */
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* value of a memory size parameter that is computed by pg_cgroups */
+#define MEMORY_AUTO -2
+
+/*
+ * PostgreSQL parameters that pg_cgroups derives from the cgroup limits.
+ * The derived values are installed like built-in defaults, so that
+ * explicit settings in the configuration files take precedence.
+ * "boot_value" is the built-in default on Linux.  We cannot ask for it,
+ * since the reset value of a parameter is the one from the configuration
+ * files.
+ */
+#define DERIVED_BGWRITER_LRU_MAXPAGES  0
+#define DERIVED_BGWRITER_FLUSH_AFTER   1
+#define DERIVED_CHECKPOINT_FLUSH_AFTER 2
+#define DERIVED_PARALLEL_PER_GATHER    3
+#define DERIVED_PARALLEL_WORKERS       4
+#define DERIVED_PARALLEL_MAINTENANCE   5
+#define DERIVED_EFFECTIVE_CACHE_SIZE   6
+
+static struct {
+	char *name;
+	char *boot_value;
+	bool active;
+} derived[] = {
+	{"bgwriter_lru_maxpages", "100", false},
+	{"bgwriter_flush_after", "64", false},
+	{"checkpoint_flush_after", "32", false},
+	{"max_parallel_workers_per_gather", "2", false},
+	{"max_parallel_workers", "8", false},
+	{"max_parallel_maintenance_workers", "2", false},
+	{"effective_cache_size", "524288", false}
+};
+
+/* the online CPUs and memory nodes that are the defaults of "cpus" and "memory_nodes" */
+static char *default_cpus = NULL;
+static char *default_memory_nodes = NULL;
+
+/* the derived parameters have to be recomputed */
+static bool derived_stale = false;
+/* memory context whose reset will recompute them, if any */
+static MemoryContext derived_context = NULL;
 
 /* static functions declarations */
-static bool memory_limit_check(int *newval, void **extra, GucSource source);
-static void memory_limit_assign(int newval, void *extra);
+static bool memory_limit_check(char **newval, void **extra, GucSource source);
+static void memory_limit_assign(const char *newval, void *extra);
+static const char *memory_limit_show(void);
+static void apply_memory_limit(const char *setting, int conn_memory, int reserve);
+static int auto_memory_limit(int conn_memory, int reserve);
+#if PG_VERSION_NUM >= 150000
+static void reclaim_shmem_request(void);
+#endif
+static void reclaim_shmem_startup(void);
+static void publish_memory_limit(int64_t value);
+static void restore_memory_limit(void);
 static void swap_limit_assign(int newval, void *extra);
 static void oom_killer_assign(bool newval, void *extra);
+static bool parse_memory_size(const char *value, int *mb, const char **hintmsg);
+static bool is_auto(const char *value);
+static const char *format_memory_size(const char *value);
+static int auto_memory_floor(int conn_memory);
+static bool memory_soft_limit_check(char **newval, void **extra, GucSource source);
+static void memory_soft_limit_assign(const char *newval, void *extra);
+static const char *memory_soft_limit_show(void);
+static void connection_memory_assign(int newval, void *extra);
+static void page_cache_reserve_assign(int newval, void *extra);
+static void set_memory_soft_limit(const char *limit, int conn_memory);
+static void swappiness_assign(int newval, void *extra);
 static bool device_limit_check(char **newval, void **extra, GucSource source);
 static void device_limit_assign(char * const limit_name, char *newval);
 static void read_bps_limit_assign(const char *newval, void *extra);
 static void write_bps_limit_assign(const char *newval, void *extra);
 static void read_iops_limit_assign(const char *newval, void *extra);
 static void write_iops_limit_assign(const char *newval, void *extra);
+static int64_t device_limit_lookup(char * const limits, char * const device);
+static void write_pacing_assign(bool newval, void *extra);
+static void wal_write_reserve_assign(int newval, void *extra);
+static void apply_write_pacing(bool pacing, char * const limits, int reserve);
+static void derive_planner_settings_assign(bool newval, void *extra);
+static int count_cpus(char * const cpuset);
+static void apply_planner_settings(bool enabled, int share, char * const cpuset, int memory);
+static void set_derived_option(int option, int value);
+static void invalidate_derived_settings(void);
+static void derived_settings_callback(void *arg);
+static void apply_derived_settings(void);
+static void reset_derived_option(int option);
 static bool cpu_share_check(int *newval, void **extra, GucSource source);
+static void set_online_defaults(void);
+static bool online_default(char **newval, GucSource source, char * const online);
 static void cpu_share_assign(int newval, void *extra);
 static bool parse_online(char * const online, int *pmin, int *pmax);
 static bool cpuset_check(char * const newval, char * const online);
@@ -58,40 +184,87 @@ static bool cpus_check(char **newval, void **extra, GucSource source);
 static void cpus_assign(const char *newval, void *extra);
 static bool memory_nodes_check(char **newval, void **extra, GucSource source);
 static void memory_nodes_assign(const char *newval, void *extra);
+static bool max_processes_check(int *newval, void **extra, GucSource source);
+static void max_processes_assign(int newval, void *extra);
+static void huge_page_limit_assign(int newval, void *extra);
+static void kernel_memory_limit_assign(int newval, void *extra);
+static void tcp_memory_limit_assign(int newval, void *extra);
+static void counter_values(int controller, char * const prefix, Datum *values, bool *nulls);
 
 void
 _PG_init(void)
 {
-	int dummy, num_cpus;
+	char *value;
 
 	if (!process_shared_preload_libraries_in_progress)
 		ereport(FATAL,
 				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
 				 errmsg("\"pg_cgroups\" must be added to \"shared_preload_libraries\"")));
 
+	/* this must be known before we look at the kernel */
+	DefineCustomStringVariable(
+		"pg_cgroups.system_root",
+		"Directory that takes the place of \"/\" for \"/proc\" and \"/sys\".",
+		"This is only useful for testing with a simulated control group file system.",
+		&system_root,
+		"",
+		PGC_POSTMASTER,
+		GUC_NOT_IN_SAMPLE,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	/* this must be set up before anything is written to the kernel */
+	verify_init();
+
 	/* initialize cgroups library and set get GUC defaults */
-	cg_init(&cgroup_has_swap_param);
+	cg_init(system_root, &cgroup_has_swap_param);
 
-	/* set a default value (and upper limit) for cpu_share */
-	if (!parse_online(get_def_cpus(), &dummy, &num_cpus))
-		elog(FATAL, "internal error getting CPU count");
+	/* the defaults of "cpus" and "memory_nodes" follow CPU and memory hotplug */
+	default_cpus = MemoryContextStrdup(TopMemoryContext, get_def_cpus());
+	default_memory_nodes = MemoryContextStrdup(TopMemoryContext, get_def_memory_nodes());
+
+	/*
+	 * Kernel memory accounting can be disabled with "cgroup.memory=nokmem",
+	 * and newer kernels don't support limits on it any more.
+	 */
+	value = cg_get_string(CONTROLLER_MEMORY, "memory.kmem.tcp.limit_in_bytes", true);
+	if (value)
+	{
+		cgroup_has_kmem_param = true;
+		pfree(value);
+	}
 
-	max_cpu_share = (num_cpus + 1) * 100000;
+	/* the huge pages that PostgreSQL uses have "huge_page_size" or the default size */
+	if (cg_has_controller(CONTROLLER_HUGETLB))
+	{
+		const char *size_setting = GetConfigOption("huge_page_size", true, false);
+		int64_t size = size_setting ? strtoll(size_setting, NULL, 10) : 0;
+
+		if (size == 0)
+			size = get_def_huge_page_size();
+
+		if (size > 0)
+			huge_page_param = MemoryContextStrdup(
+								TopMemoryContext,
+								psprintf("hugetlb.%s.limit_in_bytes",
+										 huge_page_size_name(size)));
+	}
 
 	/* once the control group is set up, we can define the GUCs */
-	DefineCustomIntVariable(
+	DefineCustomStringVariable(
 		"pg_cgroups.memory_limit",
 		"Limit the RAM available to this cluster.",
-		"This corresponds to \"memory.limit_in_bytes\".",
-		&memory_limit,
-		-1,
-		-1,
-		INT_MAX / 2,
+		"This corresponds to \"memory.limit_in_bytes\".  \"auto\" computes "
+		"the limit from the memory parameters of PostgreSQL.",
+		&memory_limit_setting,
+		"-1",
 		PGC_SIGHUP,
-		GUC_UNIT_MB,
+		0,
 		memory_limit_check,
 		memory_limit_assign,
-		NULL
+		memory_limit_show
 	);
 
 	if (cgroup_has_swap_param)
@@ -123,6 +296,65 @@ _PG_init(void)
 		NULL
 	);
 
+	DefineCustomStringVariable(
+		"pg_cgroups.memory_soft_limit",
+		"Limit for the RAM of this cluster when the system is short of memory.",
+		"This corresponds to \"memory.soft_limit_in_bytes\".  "
+		"\"auto\" protects \"shared_buffers\" and the memory of all connections.",
+		&memory_soft_limit,
+		"-1",
+		PGC_SIGHUP,
+		0,
+		memory_soft_limit_check,
+		memory_soft_limit_assign,
+		memory_soft_limit_show
+	);
+
+	DefineCustomIntVariable(
+		"pg_cgroups.connection_memory",
+		"Estimated memory used by a single connection.",
+		"This is used to compute automatic memory limits.",
+		&connection_memory,
+		8,
+		1,
+		INT_MAX / 2,
+		PGC_SIGHUP,
+		GUC_UNIT_MB,
+		NULL,
+		connection_memory_assign,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"pg_cgroups.page_cache_reserve",
+		"Memory for the file system cache.",
+		"This is used to compute an automatic \"pg_cgroups.memory_limit\".",
+		&page_cache_reserve,
+		1024,
+		0,
+		INT_MAX / 2,
+		PGC_SIGHUP,
+		GUC_UNIT_MB,
+		NULL,
+		page_cache_reserve_assign,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"pg_cgroups.swappiness",
+		"Tendency of the kernel to swap out memory of this cluster.",
+		"This corresponds to \"memory.swappiness\".",
+		&swappiness,
+		get_def_swappiness(),
+		0,
+		100,
+		PGC_SIGHUP,
+		0,
+		NULL,
+		swappiness_assign,
+		NULL
+	);
+
 	DefineCustomStringVariable(
 		"pg_cgroups.read_bps_limit",
 		"Sets the read I/O limit per device in bytes.",
@@ -182,7 +414,7 @@ _PG_init(void)
 		&cpu_share,
 		-1,
 		-1,
-		max_cpu_share,
+		INT_MAX,	/* the online CPUs are checked in cpu_share_check() */
 		PGC_SIGHUP,
 		0,
 		cpu_share_check,
@@ -216,6 +448,113 @@ _PG_init(void)
 		NULL
 	);
 
+	if (cg_has_controller(CONTROLLER_PIDS))
+		DefineCustomIntVariable(
+			"pg_cgroups.max_processes",
+			"Limit the number of processes in this cluster.",
+			"This corresponds to \"pids.max\".",
+			&max_processes,
+			-1,
+			-1,
+			INT_MAX,
+			PGC_SIGHUP,
+			0,
+			max_processes_check,
+			max_processes_assign,
+			NULL
+		);
+
+	if (huge_page_param != NULL)
+		DefineCustomIntVariable(
+			"pg_cgroups.huge_page_limit",
+			"Limit the huge pages available to this cluster.",
+			"This corresponds to \"hugetlb.<size>.limit_in_bytes\" for the huge page size in use.",
+			&huge_page_limit,
+			-1,
+			-1,
+			INT_MAX / 2,
+			PGC_SIGHUP,
+			GUC_UNIT_MB,
+			NULL,
+			huge_page_limit_assign,
+			NULL
+		);
+
+	if (cgroup_has_kmem_param)
+	{
+		DefineCustomIntVariable(
+			"pg_cgroups.kernel_memory_limit",
+			"Limit the kernel memory used for this cluster.",
+			"This corresponds to \"memory.kmem.limit_in_bytes\".",
+			&kernel_memory_limit,
+			-1,
+			-1,
+			INT_MAX / 2,
+			PGC_SIGHUP,
+			GUC_UNIT_MB,
+			NULL,
+			kernel_memory_limit_assign,
+			NULL
+		);
+
+		DefineCustomIntVariable(
+			"pg_cgroups.tcp_memory_limit",
+			"Limit the memory used for TCP socket buffers of this cluster.",
+			"This corresponds to \"memory.kmem.tcp.limit_in_bytes\".",
+			&tcp_memory_limit,
+			-1,
+			-1,
+			INT_MAX / 2,
+			PGC_SIGHUP,
+			GUC_UNIT_MB,
+			NULL,
+			tcp_memory_limit_assign,
+			NULL
+		);
+	}
+
+	DefineCustomBoolVariable(
+		"pg_cgroups.write_pacing",
+		"Derive the write pacing of checkpointer and background writer from the write limit.",
+		"This adjusts \"bgwriter_lru_maxpages\", \"bgwriter_flush_after\" and \"checkpoint_flush_after\".",
+		&write_pacing,
+		false,
+		PGC_SIGHUP,
+		0,
+		NULL,
+		write_pacing_assign,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"pg_cgroups.wal_write_reserve",
+		"Percentage of the write limit reserved for WAL if it is on the data device.",
+		"This is only used if \"pg_cgroups.write_pacing\" is enabled.",
+		&wal_write_reserve,
+		20,
+		0,
+		99,
+		PGC_SIGHUP,
+		0,
+		NULL,
+		wal_write_reserve_assign,
+		NULL
+	);
+
+	DefineCustomBoolVariable(
+		"pg_cgroups.derive_planner_settings",
+		"Derive parallelism and cache size settings from the cgroup limits.",
+		"This adjusts \"max_parallel_workers_per_gather\", \"max_parallel_workers\", "
+		"\"max_parallel_maintenance_workers\" and \"effective_cache_size\".",
+		&derive_planner_settings,
+		false,
+		PGC_SIGHUP,
+		0,
+		NULL,
+		derive_planner_settings_assign,
+		NULL
+	);
+
 	DefineCustomStringVariable(
 		"pg_cgroups.version",
 		"The version of pg_cgroups.",
@@ -229,23 +568,140 @@ _PG_init(void)
 		NULL
 	);
 
+	/*
+	 * The monitor, the statement limits, the groups, the autovacuum
+	 * and OOM policies, the exporter and the scheduler define their
+	 * own parameters.
+	 */
+	monitor_init();
+	statement_limits_init();
+	groups_init();
+	autovacuum_init();
+	oom_init();
+	exporter_init();
+	schedule_init();
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = reclaim_shmem_request;
+#else
+	RequestAddinShmemSpace(MAXALIGN(sizeof(ReclaimShared)));
+	RequestNamedLWLockTranche("pg_cgroups reclaim", 1);
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = reclaim_shmem_startup;
+
 	EmitWarningsOnPlaceholders("pg_cgroups");
+
+	/* now that all parameters are defined */
+	apply_derived_settings();
+}
+
+#if PG_VERSION_NUM >= 150000
+void
+reclaim_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(MAXALIGN(sizeof(ReclaimShared)));
+	RequestNamedLWLockTranche("pg_cgroups reclaim", 1);
+}
+#endif
+
+void
+reclaim_shmem_startup(void)
+{
+	bool found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	reclaim = ShmemInitStruct("pg_cgroups reclaim",
+							  sizeof(ReclaimShared),
+							  &found);
+	if (!found)
+	{
+		reclaim->lock = &(GetNamedLWLockTranche("pg_cgroups reclaim"))->lock;
+		pg_atomic_init_u64(&reclaim->memory_limit, (uint64) -1);
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	/* the limit was set before there was shared memory */
+	publish_memory_limit(memory_limit == -1 ? -1 : memory_limit * (int64_t)1048576);
 }
 
 bool
-memory_limit_check(int *newval, void **extra, GucSource source)
+memory_limit_check(char **newval, void **extra, GucSource source)
+{
+	const char *hintmsg = NULL;
+	int mb;
+
+	if (!parse_memory_size(*newval, &mb, &hintmsg))
+	{
+		GUC_check_errdetail(
+			"The value must be \"auto\", a percentage of the RAM, -1 or a memory size."
+		);
+		if (hintmsg)
+			GUC_check_errhint("%s", hintmsg);
+
+		return false;
+	}
+
+	if (mb == 0)
+	{
+		GUC_check_errdetail("The memory limit cannot be 0.");
+
+		return false;
+	}
+
+	return true;
+}
+
+void
+memory_limit_assign(const char *newval, void *extra)
+{
+	apply_memory_limit(newval, connection_memory, page_cache_reserve);
+}
+
+const char *
+memory_limit_show(void)
 {
-	return (bool) (*newval != 0);
+	return format_memory_size(memory_limit_setting);
 }
 
+/*
+ * Compute the memory limit in MB and set it in the kernel.
+ * With "auto", this is called whenever a parameter that
+ * influences the limit changes.
+ */
 void
-memory_limit_assign(int newval, void *extra)
+apply_memory_limit(const char *setting, int conn_memory, int reserve)
 {
+	int newval;
 	int64_t mem_value, swap_value, newtotal;
 
+	/* "memory_limit_setting" is not yet set while the parameters are defined */
+	if (setting == NULL)
+		return;
+
+	(void) parse_memory_size(setting, &newval, NULL);
+
+	if (newval == MEMORY_AUTO)
+		newval = auto_memory_limit(conn_memory, reserve);
+
+	/* every process needs the derived parameters */
+	invalidate_derived_settings();
+
 	/* only the postmaster changes the kernel */
 	if (MyProcPid != PostmasterPid)
+	{
+		memory_limit = newval;
 		return;
+	}
 
 	/* convert from MB to bytes */
 	mem_value = (newval == -1) ? -1 : newval * (int64_t)1048576;
@@ -259,21 +715,191 @@ memory_limit_assign(int newval, void *extra)
 	/* convert from MB to bytes */
 	swap_value = (newtotal == -1) ? -1 : newtotal * 1048576;
 
+	/*
+	 * reclaim_memory() restores the published limit, so we publish it
+	 * right before "memory.limit_in_bytes" is written, once the limit on
+	 * memory + swap allows it.
+	 */
 	if (newval == -1
 		|| (newval > memory_limit && memory_limit != -1))
 	{
 		/* we have to raise the limit on memory + swap first */
 		if (cgroup_has_swap_param)
 			cg_set_int64(CONTROLLER_MEMORY, "memory.memsw.limit_in_bytes", swap_value);
+		publish_memory_limit(mem_value);
 		cg_set_int64(CONTROLLER_MEMORY, "memory.limit_in_bytes", mem_value);
 	}
 	else
 	{
 		/* we have to lower the limit on memory + swap last */
+		publish_memory_limit(mem_value);
 		cg_set_int64(CONTROLLER_MEMORY, "memory.limit_in_bytes", mem_value);
 		if (cgroup_has_swap_param)
 			cg_set_int64(CONTROLLER_MEMORY, "memory.memsw.limit_in_bytes", swap_value);
 	}
+
+	memory_limit = newval;
+}
+
+/*
+ * Estimate the memory that the cluster can use at most:
+ * "shared_buffers", the memory of each possible connection, the memory
+ * for maintenance operations and autovacuum and a reserve for the file
+ * system cache.
+ */
+int
+auto_memory_limit(int conn_memory, int reserve)
+{
+	int64_t kb;
+	int av_mem = (autovacuum_work_mem == -1) ? maintenance_work_mem
+											 : autovacuum_work_mem;
+
+	kb = (int64_t) NBuffers * (BLCKSZ / 1024)
+		 + (int64_t) MaxConnections * (conn_memory * 1024 + work_mem)
+		 + (int64_t) autovacuum_max_workers * av_mem
+		 + maintenance_work_mem
+		 + (int64_t) reserve * 1024;
+
+	return (int) Min(kb / 1024, INT_MAX / 2);
+}
+
+/*
+ * The postmaster publishes the memory limit for reclaim_memory().
+ * This is a no-op until there is shared memory.
+ */
+void
+publish_memory_limit(int64_t value)
+{
+	if (reclaim == NULL)
+		return;
+
+	pg_atomic_write_u64(&reclaim->memory_limit, (uint64) value);
+	pg_memory_barrier();
+}
+
+/*
+ * Restore the memory limit that the postmaster applied last.  If the
+ * postmaster publishes a new limit while we write the old one, we write
+ * again, so that its value wins.  Like the lowered limit, this is not
+ * reported to the verifier, since it is the postmaster's own value.
+ */
+void
+restore_memory_limit(void)
+{
+	int64_t limit;
+
+	do
+	{
+		limit = (int64_t) pg_atomic_read_u64(&reclaim->memory_limit);
+
+		if (!cg_try_set_int64(CONTROLLER_MEMORY, "memory.limit_in_bytes", limit))
+			ereport(WARNING,
+					(errcode(ERRCODE_SYSTEM_ERROR),
+					 errmsg("could not restore the memory limit after reclaiming memory: %m")));
+
+		pg_memory_barrier();
+	} while ((int64_t) pg_atomic_read_u64(&reclaim->memory_limit) != limit);
+}
+
+/*
+ * "auto" depends on "work_mem" and other parameters that have no assign
+ * hook of ours.  The postmaster computes it when a reload processes
+ * "pg_cgroups.memory_limit", but parameters that come later in the
+ * configuration files still have their old values then.  The monitor
+ * calls this after each reload, when all parameters are current.  If the
+ * limit differs from the one that the postmaster applied, the postmaster
+ * has to reload once more, since only the postmaster changes the kernel.
+ */
+void
+check_auto_memory_limit(void)
+{
+	static int requested = -1;
+	int newval;
+
+	if (reclaim == NULL || memory_limit_setting == NULL
+		|| !is_auto(memory_limit_setting))
+		return;
+
+	newval = auto_memory_limit(connection_memory, page_cache_reserve);
+
+	if ((int64_t) pg_atomic_read_u64(&reclaim->memory_limit) == newval * (int64_t)1048576)
+	{
+		requested = -1;
+		return;
+	}
+
+	/* don't keep reloading if the postmaster cannot get there */
+	if (newval == requested)
+		return;
+
+	requested = newval;
+
+	ereport(LOG,
+			(errmsg("reloading the configuration to set the automatic memory limit to %d MB",
+					newval)));
+	kill(PostmasterPid, SIGHUP);
+}
+
+/*
+ * Make the kernel reclaim up to "bytes" of file system cache from the
+ * cluster's control group by temporarily lowering "memory.limit_in_bytes"
+ * below the current usage.  The kernel reclaims memory until the usage
+ * is below the new limit or it gives up, and then the configured limit
+ * is restored, even if there is an error.  Concurrent callers are
+ * serialized, so that none of them mistakes the lowered limit for the
+ * configured one.
+ * "memory.memsw.limit_in_bytes" stays unchanged: since the memory limit is
+ * lowered first and restored later, it never exceeds the memory + swap limit.
+ * We never lower the limit by more than the inactive file system cache,
+ * but that does not prevent swapping: the kernel picks the pages to
+ * reclaim itself and swaps out anonymous memory as "memory.swappiness"
+ * allows, and backends that allocate memory while the limit is lowered
+ * hit the lowered limit.
+ * Returns the number of bytes by which the memory usage dropped.
+ */
+int64_t
+reclaim_memory(int64_t bytes)
+{
+	char *value;
+	int64_t usage, target, inactive, page_size;
+
+	LWLockAcquire(reclaim->lock, LW_EXCLUSIVE);
+
+	value = cg_get_string(CONTROLLER_MEMORY, "memory.usage_in_bytes", false);
+	usage = strtoll(value, NULL, 10);
+	value = cg_get_string(CONTROLLER_MEMORY, "memory.stat", false);
+	inactive = cg_stat_value(value, "total_inactive_file");
+
+	bytes = Min(bytes, inactive);
+	if (bytes <= 0)
+	{
+		LWLockRelease(reclaim->lock);
+		return 0;
+	}
+
+	/* the kernel rounds the limit down to whole pages */
+	page_size = sysconf(_SC_PAGESIZE);
+	target = (usage - bytes) / page_size * page_size;
+
+	PG_TRY();
+	{
+		/* failure means that the kernel could not reclaim enough memory */
+		(void) cg_try_set_int64(CONTROLLER_MEMORY, "memory.limit_in_bytes", target);
+	}
+	PG_CATCH();
+	{
+		restore_memory_limit();
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	restore_memory_limit();
+
+	LWLockRelease(reclaim->lock);
+
+	value = cg_get_string(CONTROLLER_MEMORY, "memory.usage_in_bytes", false);
+
+	return Max(usage - strtoll(value, NULL, 10), 0);
 }
 
 void
@@ -314,13 +940,179 @@ oom_killer_assign(bool newval, void *extra)
 	cg_set_int64(CONTROLLER_MEMORY, "memory.oom_control", oom_value);
 }
 
+/*
+ * Parse the value of a memory size parameter.
+ * This can be "auto", a percentage of the RAM, -1 for "no limit"
+ * or a size, which is in MB unless a unit is given.
+ * Returns false if the value is invalid.
+ */
 bool
-device_limit_check(char **newval, void **extra, GucSource source)
+parse_memory_size(const char *value, int *mb, const char **hintmsg)
 {
-	char *val = pstrdup(*newval),
-		 *freeme = val;
+	char *end;
+	long percent;
 
-	if (*val == '\0')
+	if (is_auto(value))
+	{
+		*mb = MEMORY_AUTO;
+		return true;
+	}
+
+	percent = strtol(value, &end, 10);
+	if (end != value && strcmp(end, "%") == 0)
+	{
+		if (percent < 1 || percent > 100)
+			return false;
+
+		*mb = (int) Min((int64_t) sysconf(_SC_PHYS_PAGES)
+						* sysconf(_SC_PAGE_SIZE) / 1048576 * percent / 100,
+						INT_MAX / 2);
+		return true;
+	}
+
+	if (!parse_int(value, mb, GUC_UNIT_MB, hintmsg))
+		return false;
+
+	return (bool) (*mb >= -1);
+}
+
+bool
+is_auto(const char *value)
+{
+	return (bool) (value != NULL && pg_strcasecmp(value, "auto") == 0);
+}
+
+/*
+ * Display a memory size parameter like an integer parameter with unit MB,
+ * unless it is "auto" or a percentage.
+ */
+const char *
+format_memory_size(const char *value)
+{
+	static char buf[30];
+	int mb;
+
+	if (value == NULL
+		|| strchr(value, '%') != NULL
+		|| !parse_memory_size(value, &mb, NULL)
+		|| mb == MEMORY_AUTO
+		|| mb <= 0)
+		return value;
+
+	if (mb % (1024 * 1024) == 0)
+		snprintf(buf, 30, "%dTB", mb / (1024 * 1024));
+	else if (mb % 1024 == 0)
+		snprintf(buf, 30, "%dGB", mb / 1024);
+	else
+		snprintf(buf, 30, "%dMB", mb);
+
+	return buf;
+}
+
+/*
+ * Estimate the memory that the cluster needs to work efficiently:
+ * "shared_buffers" plus the memory for each possible connection.
+ */
+int
+auto_memory_floor(int conn_memory)
+{
+	int64_t mb;
+
+	mb = (int64_t) NBuffers * BLCKSZ / 1048576
+		 + (int64_t) MaxConnections * conn_memory;
+
+	return (int) Min(mb, INT_MAX / 2);
+}
+
+bool
+memory_soft_limit_check(char **newval, void **extra, GucSource source)
+{
+	const char *hintmsg = NULL;
+	int mb;
+
+	if (!parse_memory_size(*newval, &mb, &hintmsg))
+	{
+		GUC_check_errdetail(
+			"The value must be \"auto\", a percentage of the RAM, -1 or a memory size."
+		);
+		if (hintmsg)
+			GUC_check_errhint("%s", hintmsg);
+
+		return false;
+	}
+
+	return true;
+}
+
+void
+memory_soft_limit_assign(const char *newval, void *extra)
+{
+	set_memory_soft_limit(newval, connection_memory);
+}
+
+const char *
+memory_soft_limit_show(void)
+{
+	return format_memory_size(memory_soft_limit);
+}
+
+/* the automatic limits have to be recomputed if their inputs change */
+void
+connection_memory_assign(int newval, void *extra)
+{
+	if (is_auto(memory_soft_limit))
+		set_memory_soft_limit(memory_soft_limit, newval);
+	if (is_auto(memory_limit_setting))
+		apply_memory_limit(memory_limit_setting, newval, page_cache_reserve);
+}
+
+void
+page_cache_reserve_assign(int newval, void *extra)
+{
+	if (is_auto(memory_limit_setting))
+		apply_memory_limit(memory_limit_setting, connection_memory, newval);
+}
+
+void
+set_memory_soft_limit(const char *limit, int conn_memory)
+{
+	int mb;
+
+	/* only the postmaster changes the kernel */
+	if (MyProcPid != PostmasterPid)
+		return;
+
+	/* "memory_soft_limit" is not yet set while the parameters are defined */
+	if (limit == NULL)
+		return;
+
+	(void) parse_memory_size(limit, &mb, NULL);
+
+	if (mb == MEMORY_AUTO)
+		mb = auto_memory_floor(conn_memory);
+
+	/* convert from MB to bytes */
+	cg_set_int64(CONTROLLER_MEMORY, "memory.soft_limit_in_bytes",
+				 (mb == -1) ? -1 : mb * (int64_t)1048576);
+}
+
+void
+swappiness_assign(int newval, void *extra)
+{
+	/* only the postmaster changes the kernel */
+	if (MyProcPid != PostmasterPid)
+		return;
+
+	cg_set_int64(CONTROLLER_MEMORY, "memory.swappiness", (int64_t) newval);
+}
+
+bool
+device_limit_check(char **newval, void **extra, GucSource source)
+{
+	char *val = pstrdup(*newval),
+		 *freeme = val;
+
+	if (*val == '\0')
 		return true;
 
 	/* loop through comma-separated list */
@@ -471,6 +1263,9 @@ read_bps_limit_assign(const char *newval, void *extra)
 void
 write_bps_limit_assign(const char *newval, void *extra)
 {
+	/* every process needs the derived parameters */
+	invalidate_derived_settings();
+
 	device_limit_assign("blkio.throttle.write_bps_device", (char *) newval);
 }
 
@@ -486,15 +1281,305 @@ write_iops_limit_assign(const char *newval, void *extra)
 	device_limit_assign("blkio.throttle.write_iops_device", (char *) newval);
 }
 
+/*
+ * Find the limit for "device" in a list of device limits that
+ * has passed device_limit_check().
+ * Returns -1 if there is no limit for the device.
+ */
+int64_t
+device_limit_lookup(char * const limits, char * const device)
+{
+	char *p = limits;
+	size_t len = strlen(device);
+	int64_t value;
+
+	while (p != NULL && *p != '\0')
+	{
+		if (strncmp(p, device, len) == 0 && p[len] == ' ')
+		{
+			value = strtoll(p + len, NULL, 10);
+
+			/* a limit of 0 means "no limit" */
+			return (value == 0) ? -1 : value;
+		}
+
+		if ((p = strchr(p, ',')) != NULL)
+			++p;
+	}
+
+	return -1;
+}
+
+void
+write_pacing_assign(bool newval, void *extra)
+{
+	invalidate_derived_settings();
+}
+
+void
+wal_write_reserve_assign(int newval, void *extra)
+{
+	invalidate_derived_settings();
+}
+
+/*
+ * Derive the write pacing of the checkpointer and the background writer
+ * from the write limit on the disk that contains the data directory.
+ * Without that, they plan their writes as if the device was unthrottled,
+ * and the final flush of a checkpoint runs into the cgroup limit.
+ * This runs in every process, since each has its own copy of the parameters.
+ */
+void
+apply_write_pacing(bool pacing, char * const limits, int reserve)
+{
+	static int64_t warned_budget = -1;
+	char *data_device = NULL, *wal_device, *wal_dir;
+	int64_t budget = -1, pages;
+
+	if (pacing && limits != NULL && DataDir != NULL)
+		data_device = get_disk_device(DataDir);
+
+	if (data_device != NULL)
+		budget = device_limit_lookup(limits, data_device);
+
+	if (budget == -1)
+	{
+		reset_derived_option(DERIVED_BGWRITER_LRU_MAXPAGES);
+		reset_derived_option(DERIVED_BGWRITER_FLUSH_AFTER);
+		reset_derived_option(DERIVED_CHECKPOINT_FLUSH_AFTER);
+
+		return;
+	}
+
+	/* WAL competes for the same budget if it is on the same disk */
+	wal_dir = psprintf("%s/%s", DataDir, XLOGDIR);
+	wal_device = get_disk_device(wal_dir);
+	if (wal_device == NULL || strcmp(wal_device, data_device) == 0)
+		budget -= budget * reserve / 100;
+	pfree(wal_dir);
+	if (wal_device)
+		pfree(wal_device);
+
+	/* pages per second that we can write */
+	pages = Max(budget / BLCKSZ, 1);
+
+	/* the background writer should not exceed the budget in one round */
+	set_derived_option(DERIVED_BGWRITER_LRU_MAXPAGES,
+					   (int) Min(Max(pages * BgWriterDelay / 1000, 1), INT_MAX / 2));
+
+	/* force writeback about ten times per second to avoid bursts */
+	pages = Min(Max(pages / 10, 1), WRITEBACK_MAX_PENDING_FLUSHES);
+	set_derived_option(DERIVED_BGWRITER_FLUSH_AFTER, (int) pages);
+	set_derived_option(DERIVED_CHECKPOINT_FLUSH_AFTER, (int) pages);
+
+	/* warn if a checkpoint cannot finish in time, but only once per budget */
+	if (MyProcPid == PostmasterPid
+		&& budget != warned_budget
+		&& (double) NBuffers * BLCKSZ / budget
+			> CheckPointTimeout * CheckPointCompletionTarget)
+		ereport(WARNING,
+				(errmsg("write limit on device %s is too low to write \"shared_buffers\" during a checkpoint", data_device),
+				 errdetail("Writing all of \"shared_buffers\" takes %.0f seconds, but checkpoints should be done after %.0f seconds.",
+						   (double) NBuffers * BLCKSZ / budget,
+						   CheckPointTimeout * CheckPointCompletionTarget)));
+	warned_budget = budget;
+
+	pfree(data_device);
+}
+
+void
+derive_planner_settings_assign(bool newval, void *extra)
+{
+	invalidate_derived_settings();
+}
+
+/*
+ * Count the CPUs in a list that has passed cpuset_check().
+ */
+int
+count_cpus(char * const cpuset)
+{
+	char *p = cpuset;
+	long first, last;
+	int count = 0;
+
+	while (*p != '\0')
+	{
+		first = last = strtol(p, &p, 10);
+		if (*p == '-')
+			last = strtol(p + 1, &p, 10);
+		count += last - first + 1;
+
+		if (*p == ',')
+			++p;
+	}
+
+	return count;
+}
+
+/*
+ * Derive the planner's idea of the available resources from the cgroup
+ * limits, so that the cost estimates match the actual resources.
+ * The number of usable cores is determined by "cpu_share" and "cpus",
+ * and "effective_cache_size" is three quarters of "memory_limit".
+ * This runs in every process, since each has its own copy of the parameters.
+ */
+void
+apply_planner_settings(bool enabled, int share, char * const cpuset, int memory)
+{
+	int cores;
+
+	if (!enabled)
+	{
+		reset_derived_option(DERIVED_PARALLEL_PER_GATHER);
+		reset_derived_option(DERIVED_PARALLEL_WORKERS);
+		reset_derived_option(DERIVED_PARALLEL_MAINTENANCE);
+		reset_derived_option(DERIVED_EFFECTIVE_CACHE_SIZE);
+
+		return;
+	}
+
+	/* "cpus" is not yet set while the parameters are defined */
+	cores = count_cpus(cpuset ? cpuset : get_def_cpus());
+
+	/* round up, so that a fraction of a core still runs one process */
+	if (share != -1)
+		cores = Min(cores, (share + 99999) / 100000);
+
+	/* the leader participates in the parallel query */
+	set_derived_option(DERIVED_PARALLEL_PER_GATHER, cores - 1);
+	set_derived_option(DERIVED_PARALLEL_MAINTENANCE, cores - 1);
+	set_derived_option(DERIVED_PARALLEL_WORKERS, cores);
+
+	/* convert from MB to blocks */
+	if (memory == -1)
+		reset_derived_option(DERIVED_EFFECTIVE_CACHE_SIZE);
+	else
+		set_derived_option(DERIVED_EFFECTIVE_CACHE_SIZE,
+						   (int) Min((int64_t) memory * 3 / 4 * (1048576 / BLCKSZ),
+									 INT_MAX));
+}
+
+/*
+ * Set a derived parameter.  Its source is the same as that of
+ * the built-in defaults that PostgreSQL computes, like "wal_buffers".
+ */
+void
+set_derived_option(int option, int value)
+{
+	char str[20];
+
+	snprintf(str, 20, "%d", value);
+	SetConfigOption(derived[option].name, str, PGC_POSTMASTER, PGC_S_DYNAMIC_DEFAULT);
+	derived[option].active = true;
+}
+
+/* restore the original default of a derived parameter */
+void
+reset_derived_option(int option)
+{
+	if (!derived[option].active)
+		return;
+
+	SetConfigOption(derived[option].name, derived[option].boot_value,
+					PGC_POSTMASTER, PGC_S_DYNAMIC_DEFAULT);
+	derived[option].active = false;
+}
+
+/*
+ * The derived parameters depend on several parameters, and a reload
+ * processes these one at a time in the order of the configuration files.
+ * Moreover, a reload resets a derived parameter that was removed from
+ * the configuration files to its built-in default.  So the assign hooks
+ * only mark the derived parameters as stale, and they are recomputed
+ * when the current memory context is reset or deleted.  During a reload,
+ * that is the context of the configuration file processing, which is
+ * deleted once all parameters have their new values.
+ */
+void
+invalidate_derived_settings(void)
+{
+	MemoryContextCallback *callback;
+
+	derived_stale = true;
+
+	if (derived_context == CurrentMemoryContext)
+		return;
+
+	callback = (MemoryContextCallback *) MemoryContextAlloc(CurrentMemoryContext,
+															sizeof(MemoryContextCallback));
+	callback->func = derived_settings_callback;
+	callback->arg = CurrentMemoryContext;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext, callback);
+	derived_context = CurrentMemoryContext;
+}
+
+void
+derived_settings_callback(void *arg)
+{
+	if (derived_context == (MemoryContext) arg)
+		derived_context = NULL;
+
+	/* a reload also adopts CPU and memory hotplug */
+	refresh_online_defaults();
+	apply_derived_settings();
+}
+
+/*
+ * Recompute the derived parameters if any of the parameters they depend on
+ * have changed.  Parallel workers get the derived values from their leader.
+ */
+void
+apply_derived_settings(void)
+{
+	if (!derived_stale)
+		return;
+
+	derived_stale = false;
+
+	if (IsParallelWorker())
+		return;
+
+	apply_write_pacing(write_pacing, write_bps_limit, wal_write_reserve);
+	apply_planner_settings(derive_planner_settings, cpu_share, cpus, memory_limit);
+}
+
 bool
 cpu_share_check(int *newval, void **extra, GucSource source)
 {
-	return (bool) (*newval == -1 || *newval >= 1000);
+	int dummy, num_cpus;
+
+	if (*newval == -1)
+		return true;
+
+	if (*newval < 1000)
+		return false;
+
+	/* CPUs may have been added since the last check */
+	(void) cg_refresh_online();
+
+	if (!parse_online(get_def_cpus(), &dummy, &num_cpus))
+		elog(ERROR, "internal error getting CPU count");
+
+	if (*newval > (num_cpus + 1) * 100000)
+	{
+		GUC_check_errdetail(
+			"The value cannot exceed %d, which corresponds to all online CPUs.",
+			(num_cpus + 1) * 100000
+		);
+
+		return false;
+	}
+
+	return true;
 }
 
 void
 cpu_share_assign(int newval, void *extra)
 {
+	/* every process needs the derived parameters */
+	invalidate_derived_settings();
+
 	/* only the postmaster changes the kernel */
 	if (MyProcPid != PostmasterPid)
 		return;
@@ -687,25 +1772,148 @@ cpuset_check(char * const newval, char * const online)
 bool
 cpus_check(char **newval, void **extra, GucSource source)
 {
+	/* CPUs may have been added since the last check */
+	(void) cg_refresh_online();
+
+	if (!online_default(newval, source, get_def_cpus()))
+		return false;
+
 	return cpuset_check(*newval, get_def_cpus());
 }
 
 void
 cpus_assign(const char *newval, void *extra)
 {
+	/* every process needs the derived parameters */
+	invalidate_derived_settings();
+
 	/* only the postmaster changes the kernel */
 	if (MyProcPid != PostmasterPid)
 		return;
 
+	/* the value may contain CPUs that were added since the last check */
+	cg_extend_cpuset();
 	cg_set_string(CONTROLLER_CPUSET, "cpuset.cpus", (char *) newval);
 }
 
 bool
 memory_nodes_check(char **newval, void **extra, GucSource source)
 {
+	/* memory nodes may have been added since the last check */
+	(void) cg_refresh_online();
+
+	if (!online_default(newval, source, get_def_memory_nodes()))
+		return false;
+
 	return cpuset_check(*newval, get_def_memory_nodes());
 }
 
+/*
+ * The default for "cpus" and "memory_nodes" is everything that is online.
+ * The built-in default is what was online at server start, so replace it
+ * with what is online now.
+ */
+bool
+online_default(char **newval, GucSource source, char * const online)
+{
+	char *value;
+
+	if (source > PGC_S_DYNAMIC_DEFAULT || strcmp(*newval, online) == 0)
+		return true;
+
+	if ((value = guc_malloc(LOG, strlen(online) + 1)) == NULL)
+		return false;
+
+	strcpy(value, online);
+	free(*newval);
+	*newval = value;
+
+	return true;
+}
+
+/*
+ * Make the online CPUs and memory nodes the defaults of "cpus" and
+ * "memory_nodes", unless they already are.  An explicit setting takes
+ * precedence over that.
+ */
+void
+set_online_defaults(void)
+{
+	if (strcmp(default_cpus, get_def_cpus()) != 0)
+	{
+		pfree(default_cpus);
+		default_cpus = MemoryContextStrdup(TopMemoryContext, get_def_cpus());
+		SetConfigOption("pg_cgroups.cpus", default_cpus,
+						PGC_POSTMASTER, PGC_S_DYNAMIC_DEFAULT);
+	}
+
+	if (strcmp(default_memory_nodes, get_def_memory_nodes()) != 0)
+	{
+		pfree(default_memory_nodes);
+		default_memory_nodes = MemoryContextStrdup(TopMemoryContext, get_def_memory_nodes());
+		SetConfigOption("pg_cgroups.memory_nodes", default_memory_nodes,
+						PGC_POSTMASTER, PGC_S_DYNAMIC_DEFAULT);
+	}
+}
+
+/*
+ * Adopt CPUs and memory nodes that were hot-added or removed since the
+ * defaults were set.  This is called when a client backend starts, so
+ * that it shows the current defaults, and after each reload.  In the
+ * postmaster, the assign hooks then extend the cluster's cpuset.
+ */
+void
+refresh_online_defaults(void)
+{
+	/* parallel workers get the parameters from their leader */
+	if (IsParallelWorker())
+		return;
+
+	(void) cg_refresh_online();
+	set_online_defaults();
+
+	/* the planner settings depend on "cpus" */
+	apply_derived_settings();
+}
+
+/*
+ * Follow CPU and memory hotplug.  The monitor calls this after each
+ * sample.  Only the postmaster changes the kernel, so if CPUs or memory
+ * nodes were added or removed, it has to reload the configuration to
+ * make them the defaults of "cpus" and "memory_nodes" and to extend the
+ * cluster's cpuset.
+ */
+void
+hotplug_policy(void)
+{
+	/* check hooks can also refresh the online values, so remember our own */
+	static char *known_cpus = NULL, *known_nodes = NULL;
+
+	if (known_cpus == NULL)
+	{
+		known_cpus = MemoryContextStrdup(TopMemoryContext, get_def_cpus());
+		known_nodes = MemoryContextStrdup(TopMemoryContext, get_def_memory_nodes());
+	}
+
+	(void) cg_refresh_online();
+
+	if (strcmp(known_cpus, get_def_cpus()) == 0
+		&& strcmp(known_nodes, get_def_memory_nodes()) == 0)
+		return;
+
+	pfree(known_cpus);
+	pfree(known_nodes);
+	known_cpus = MemoryContextStrdup(TopMemoryContext, get_def_cpus());
+	known_nodes = MemoryContextStrdup(TopMemoryContext, get_def_memory_nodes());
+
+	ereport(LOG,
+			(errmsg("online CPUs are now \"%s\", online memory nodes are now \"%s\"",
+					get_def_cpus(), get_def_memory_nodes()),
+			 errdetail("The configuration is reloaded to adopt them.")));
+
+	kill(PostmasterPid, SIGHUP);
+}
+
 void
 memory_nodes_assign(const char *newval, void *extra)
 {
@@ -713,5 +1921,241 @@ memory_nodes_assign(const char *newval, void *extra)
 	if (MyProcPid != PostmasterPid)
 		return;
 
+	/* the value may contain memory nodes that were added since the last check */
+	cg_extend_cpuset();
 	cg_set_string(CONTROLLER_CPUSET, "cpuset.mems", (char *) newval);
 }
+
+bool
+max_processes_check(int *newval, void **extra, GucSource source)
+{
+	if (*newval == 0)
+	{
+		GUC_check_errdetail("The limit cannot be 0, since then no process could be started.");
+
+		return false;
+	}
+
+	return true;
+}
+
+void
+max_processes_assign(int newval, void *extra)
+{
+	/* only the postmaster changes the kernel */
+	if (MyProcPid != PostmasterPid)
+		return;
+
+	if (newval == -1)
+		cg_set_string(CONTROLLER_PIDS, "pids.max", "max");
+	else
+		cg_set_int64(CONTROLLER_PIDS, "pids.max", (int64_t) newval);
+}
+
+void
+huge_page_limit_assign(int newval, void *extra)
+{
+	/* only the postmaster changes the kernel */
+	if (MyProcPid != PostmasterPid)
+		return;
+
+	cg_set_int64(CONTROLLER_HUGETLB,
+				 huge_page_param,
+				 (newval == -1) ? -1 : (int64_t) newval * 1048576);
+}
+
+void
+kernel_memory_limit_assign(int newval, void *extra)
+{
+	char *value;
+
+	/* only the postmaster changes the kernel */
+	if (MyProcPid != PostmasterPid)
+		return;
+
+	/*
+	 * Kernels from 6.1 on reject any write to this parameter,
+	 * so don't write it unless there is something to change.
+	 */
+	value = cg_get_string(CONTROLLER_MEMORY, "memory.kmem.limit_in_bytes", false);
+	if (newval == -1 && strtoll(value, NULL, 10) >= INT64CONST(0x7FFFFFFFFFFFF000) / 2)
+	{
+		pfree(value);
+		return;
+	}
+	pfree(value);
+
+	cg_set_int64(CONTROLLER_MEMORY,
+				 "memory.kmem.limit_in_bytes",
+				 (newval == -1) ? -1 : (int64_t) newval * 1048576);
+}
+
+void
+tcp_memory_limit_assign(int newval, void *extra)
+{
+	/* only the postmaster changes the kernel */
+	if (MyProcPid != PostmasterPid)
+		return;
+
+	cg_set_int64(CONTROLLER_MEMORY,
+				 "memory.kmem.tcp.limit_in_bytes",
+				 (newval == -1) ? -1 : (int64_t) newval * 1048576);
+}
+
+/*
+ * Read the usage, maximal usage, limit and failure count for a
+ * memory counter like "memory.kmem." or "hugetlb.2MB." into
+ * four entries of "values" and "nulls".
+ * A limit of "unlimited" is returned as NULL.
+ */
+void
+counter_values(int controller, char * const prefix, Datum *values, bool *nulls)
+{
+	char *value;
+	int64_t limit;
+
+	value = cg_get_string(controller, psprintf("%susage_in_bytes", prefix), false);
+	values[0] = Int64GetDatum(strtoll(value, NULL, 10));
+
+	value = cg_get_string(controller, psprintf("%smax_usage_in_bytes", prefix), false);
+	values[1] = Int64GetDatum(strtoll(value, NULL, 10));
+
+	/* without a limit, the kernel reports a huge number */
+	value = cg_get_string(controller, psprintf("%slimit_in_bytes", prefix), false);
+	limit = strtoll(value, NULL, 10);
+	nulls[2] = (limit >= INT64CONST(0x7FFFFFFFFFFFF000) / 2);
+	values[2] = Int64GetDatum(limit);
+
+	value = cg_get_string(controller, psprintf("%sfailcnt", prefix), false);
+	values[3] = Int64GetDatum(strtoll(value, NULL, 10));
+}
+
+/*
+ * SQL function that returns usage, maximal usage, limit and the number
+ * of failed allocations for all huge page sizes.
+ */
+Datum
+pg_cgroups_huge_pages(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	int64_t *sizes;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		TupleDesc tupdesc;
+
+		if (!cg_has_controller(CONTROLLER_HUGETLB))
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("the \"hugetlb\" controller is not available"),
+					 errhint("Add the \"hugetlb\" controller to the \"/postgres\" control group as described in the pg_cgroup documentation.")));
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		/* there are only a few huge page sizes */
+		sizes = palloc(sizeof(int64_t) * 10);
+		funcctx->max_calls = get_huge_page_sizes(sizes, 10);
+		funcctx->user_fctx = sizes;
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	sizes = (int64_t *) funcctx->user_fctx;
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		char *name = huge_page_size_name(sizes[funcctx->call_cntr]);
+		Datum values[5];
+		bool nulls[5] = {false, false, false, false, false};
+		HeapTuple tuple;
+
+		values[0] = CStringGetTextDatum(name);
+		counter_values(CONTROLLER_HUGETLB,
+					   psprintf("hugetlb.%s.", name),
+					   values + 1,
+					   nulls + 1);
+
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * SQL function that returns usage, maximal usage, limit and the number
+ * of failed allocations for kernel memory and for TCP socket buffers.
+ */
+Datum
+pg_cgroups_kernel_memory(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	static char * const kinds[2] = {"kernel", "tcp"};
+	static char * const prefixes[2] = {"memory.kmem.", "memory.kmem.tcp."};
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		TupleDesc tupdesc;
+
+		if (!cgroup_has_kmem_param)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("kernel memory accounting is not available")));
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+		funcctx->max_calls = lengthof(kinds);
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		Datum values[5];
+		bool nulls[5] = {false, false, false, false, false};
+		HeapTuple tuple;
+
+		values[0] = CStringGetTextDatum(kinds[funcctx->call_cntr]);
+		counter_values(CONTROLLER_MEMORY,
+					   prefixes[funcctx->call_cntr],
+					   values + 1,
+					   nulls + 1);
+
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * SQL function that reclaims file system cache from the cluster.
+ */
+Datum
+pg_cgroups_reclaim(PG_FUNCTION_ARGS)
+{
+	int64 bytes = PG_GETARG_INT64(0);
+
+	if (bytes < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("the amount of memory to reclaim cannot be negative")));
+
+	PG_RETURN_INT64(reclaim_memory(bytes));
+}
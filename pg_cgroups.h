@@ -1,19 +1,97 @@
 #define PG_CGROUPS_VERSION "pg_cgroups version 0.9.1devel"
 
 /* cgroup controllers we use */
-#define MAX_CONTROLLERS 4
+#define MAX_CONTROLLERS 9
 
-#define CONTROLLER_MEMORY 0
-#define CONTROLLER_CPU    1
-#define CONTROLLER_BLKIO  2
-#define CONTROLLER_CPUSET 3
+#define CONTROLLER_MEMORY  0
+#define CONTROLLER_CPU     1
+#define CONTROLLER_BLKIO   2
+#define CONTROLLER_CPUSET  3
+#define CONTROLLER_FREEZER 4	/* optional */
+#define CONTROLLER_PIDS    5	/* optional */
+#define CONTROLLER_HUGETLB 6	/* optional */
+#define CONTROLLER_NET_CLS  7	/* optional */
+#define CONTROLLER_NET_PRIO 8	/* optional */
+
+/* maximal length of a group name */
+#define MAX_GROUP_NAME 63
 
 /* defined in pg_cgrops.c */
 extern void _PG_init(void);
+extern int64_t reclaim_memory(int64_t bytes);
+extern void check_auto_memory_limit(void);
+extern void refresh_online_defaults(void);
+extern void hotplug_policy(void);
+
+/* called after a control group parameter was written */
+typedef void (*cg_write_hook_type) (int controller, char * const cgroup,
+									char * const parameter, char * const value);
 
 /* defined in libcg1.c */
-extern void cg_init(bool *cgroup_has_swap_param);
+extern cg_write_hook_type cg_write_hook;
+extern void cg_init(char * const root, bool *cgroup_has_swap_param);
+extern char *system_path(char * const path);
+extern bool cg_refresh_online(void);
+extern void cg_extend_cpuset(void);
 extern char * const get_def_cpus(void);
 extern char * const get_def_memory_nodes(void);
+extern int get_def_swappiness(void);
 extern void cg_set_string(int controller, char * const parameter, char * const value);
 extern void cg_set_int64(int controller, char * const parameter, int64_t value);
+extern bool cg_try_set_int64(int controller, char * const parameter, int64_t value);
+extern char *cg_read_string(int controller, char * const cgroup, char * const parameter, bool ignore_errors);
+extern bool cg_try_write_string(int controller, char * const cgroup, char * const parameter, char * const value);
+extern char *cg_get_string(int controller, char * const parameter, bool ignore_errors);
+extern int64_t cg_stat_value(char * const stat, char * const key);
+extern char *get_disk_device(char * const path);
+extern bool cg_has_controller(int controller);
+extern int get_huge_page_sizes(int64_t *sizes, int max);
+extern int64_t get_def_huge_page_size(void);
+extern char *huge_page_size_name(int64_t size);
+extern char *get_process_title(pid_t pid);
+extern void cg_create_group(char * const group);
+extern bool cg_move_to_group(char * const group, pid_t pid);
+extern void cg_set_group_string(int controller, char * const group, char * const parameter, char * const value);
+extern char *cg_get_group_string(int controller, char * const group, char * const parameter, bool ignore_errors);
+extern int cg_open_parameter(int controller, char * const group, char * const parameter);
+
+/* defined in monitor.c */
+extern void monitor_init(void);
+
+/* defined in exporter.c */
+extern void exporter_init(void);
+
+/* defined in verify.c */
+extern void verify_init(void);
+extern void verify_policy(void);
+
+/* defined in schedule.c */
+extern void schedule_init(void);
+extern bool write_config_file(const char *path, const char *contents);
+
+/* defined in autovacuum.c */
+extern void autovacuum_init(void);
+extern void autovacuum_io_policy(void);
+
+/* defined in oom.c */
+extern void oom_init(void);
+extern void oom_backend_policy(char * const group);
+extern void oom_worker_policy(void);
+
+/* defined in statement_limits.c */
+extern void statement_limits_init(void);
+
+/* defined in groups.c */
+extern void groups_init(void);
+extern char *group_list(void);
+extern bool group_exists(char * const group);
+extern void freeze_group(char * const group, bool freeze);
+extern void freeze_policy(int64_t usage, int64_t limit);
+extern void place_archiver(void);
+extern void place_processes(char * const title, char * const group);
+extern char *process_kind(pid_t pid);
+extern char *next_group(char **list);
+extern bool check_group_settings(char * const list);
+extern int64_t group_setting(char * const list, char * const group);
+extern int64_t sum_io_stat(char * const stat, char * const operation);
+extern char *cluster_io_stat(char * const parameter);
@@ -0,0 +1,82 @@
+/*
+ * Interface for other extensions to run their processes, like background
+ * workers, in a group of pg_cgroups with its own limits.
+ *
+ * The extension requests the group in its _PG_init(), which must run
+ * while "shared_preload_libraries" is loaded:
+ *
+ *     PgCgroupsLimits limits;
+ *
+ *     pg_cgroups_init_limits(&limits);
+ *     limits.cpu_share = 50000;
+ *     pg_cgroups_request_group("compression", &limits);
+ *
+ * Then the background worker moves itself into the group at startup:
+ *
+ *     pg_cgroups_join_group("compression");
+ *
+ * The functions load pg_cgroups if necessary, so the order of the
+ * libraries in "shared_preload_libraries" does not matter.
+ */
+
+#ifndef PG_CGROUPS_API_H
+#define PG_CGROUPS_API_H
+
+#include "fmgr.h"
+
+/* version of PgCgroupsLimits */
+#define PG_CGROUPS_API_VERSION 1
+
+/* limits of a group, -1 means no limit */
+typedef struct
+{
+	int version;		/* must be PG_CGROUPS_API_VERSION */
+	int memory_limit;	/* in MB */
+	int cpu_share;		/* like "pg_cgroups.cpu_share", 100000 = 1 core */
+	int max_processes;	/* needs the "pids" controller */
+	int io_weight;		/* up to 1000, at least 1 with BFQ and 10 with CFQ */
+} PgCgroupsLimits;
+
+typedef void (*pg_cgroups_request_group_type) (const char *group,
+											   const PgCgroupsLimits *limits);
+typedef bool (*pg_cgroups_join_group_type) (const char *group);
+
+/* set all limits to "no limit" */
+static inline void
+pg_cgroups_init_limits(PgCgroupsLimits *limits)
+{
+	limits->version = PG_CGROUPS_API_VERSION;
+	limits->memory_limit = -1;
+	limits->cpu_share = -1;
+	limits->max_processes = -1;
+	limits->io_weight = -1;
+}
+
+/*
+ * Create a group with the limits, or set the limits if the group exists.
+ * "limits" can be NULL.  Errors are reported with ereport(ERROR).
+ */
+static inline void
+pg_cgroups_request_group(const char *group, const PgCgroupsLimits *limits)
+{
+	pg_cgroups_request_group_type request_group = (pg_cgroups_request_group_type)
+		load_external_function("pg_cgroups", "pg_cgroups_api_request_group", true, NULL);
+
+	request_group(group, limits);
+}
+
+/*
+ * Move the calling process into the group, or back to the cluster's
+ * control group if "group" is NULL.
+ * Returns false if the process could not be moved.
+ */
+static inline bool
+pg_cgroups_join_group(const char *group)
+{
+	pg_cgroups_join_group_type join_group = (pg_cgroups_join_group_type)
+		load_external_function("pg_cgroups", "pg_cgroups_api_join_group", true, NULL);
+
+	return join_group(group);
+}
+
+#endif  /* PG_CGROUPS_API_H */
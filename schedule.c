@@ -0,0 +1,466 @@
+#ifndef __linux__
+#error "Linux control groups are only available on Linux"
+#endif
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "executor/spi.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pg_cgroups.h"
+
+/*
+ * The scheduler is a background worker that reads the settings of the
+ * currently active time windows from the table "pg_cgroups_schedule"
+ * once a minute and writes them to SCHEDULE_FILE in the data directory,
+ * which must be included in "postgresql.conf".  When the file changes,
+ * the worker makes the postmaster reload the configuration, so that
+ * the settings take effect through the same assign hooks as any other
+ * configuration change, and "SHOW" reports what is in the kernel.
+ * The file is only written if all settings are valid.
+ */
+
+#define SCHEDULE_FILE "pg_cgroups.schedule.conf"
+
+/* GUC defined by the scheduler */
+static char *schedule_database = NULL;
+
+/* set by the SIGHUP handler */
+static volatile sig_atomic_t got_sighup = false;
+
+/* static functions declarations */
+static void schedule_sighup(SIGNAL_ARGS);
+static char *extension_schema(void);
+static void append_conf_value(StringInfo buf, const char *value);
+static char *read_schedule_file(const char *path);
+static void verify_schedule(const char *path, int entries);
+static void apply_schedule(void);
+
+/* entry point of the background worker */
+PGDLLEXPORT void schedule_main(Datum main_arg);
+
+/*
+ * Define the GUC and register the background worker
+ * if a schedule database is configured.
+ * This is called from _PG_init().
+ */
+void
+schedule_init(void)
+{
+	BackgroundWorker worker;
+
+	DefineCustomStringVariable(
+		"pg_cgroups.schedule_database",
+		"Database that contains the table \"pg_cgroups_schedule\".",
+		"An empty string disables the scheduler.",
+		&schedule_database,
+		"",
+		PGC_POSTMASTER,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	if (schedule_database[0] == '\0')
+		return;
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_ConsistentState;
+	worker.bgw_restart_time = 60;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "pg_cgroups");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "schedule_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "pg_cgroups scheduler");
+#if PG_VERSION_NUM >= 110000
+	snprintf(worker.bgw_type, BGW_MAXLEN, "pg_cgroups scheduler");
+#endif
+
+	RegisterBackgroundWorker(&worker);
+}
+
+void
+schedule_sighup(SIGNAL_ARGS)
+{
+	int save_errno = errno;
+
+	got_sighup = true;
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
+/*
+ * Return the quoted schema of the extension, or NULL if the extension
+ * is not installed.  The extension is relocatable.
+ */
+char *
+extension_schema(void)
+{
+	if (SPI_execute("SELECT n.nspname"
+					" FROM pg_catalog.pg_extension AS e"
+					"    JOIN pg_catalog.pg_namespace AS n ON n.oid = e.extnamespace"
+					" WHERE e.extname = 'pg_cgroups'",
+					true, 1) != SPI_OK_SELECT)
+		elog(ERROR, "cannot determine the schema of extension \"pg_cgroups\"");
+
+	if (SPI_processed == 0)
+		return NULL;
+
+	return pstrdup(quote_identifier(SPI_getvalue(SPI_tuptable->vals[0],
+												 SPI_tuptable->tupdesc,
+												 1)));
+}
+
+/* append a value as a quoted string for a configuration file */
+void
+append_conf_value(StringInfo buf, const char *value)
+{
+	const char *p;
+
+	appendStringInfoChar(buf, '\'');
+	for (p = value; *p != '\0'; ++p)
+	{
+		if (*p == '\'' || *p == '\\')
+			appendStringInfoChar(buf, *p);
+		appendStringInfoChar(buf, *p);
+	}
+	appendStringInfoChar(buf, '\'');
+}
+
+/*
+ * Read the schedule file.
+ * Returns a palloc'ed string or NULL if the file cannot be read.
+ */
+char *
+read_schedule_file(const char *path)
+{
+	StringInfoData buf;
+	char chunk[1024];
+	size_t bytes;
+	FILE *file;
+
+	if ((file = AllocateFile(path, "r")) == NULL)
+		return NULL;
+
+	initStringInfo(&buf);
+	while ((bytes = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		appendBinaryStringInfo(&buf, chunk, bytes);
+
+	if (ferror(file))
+	{
+		FreeFile(file);
+		pfree(buf.data);
+		return NULL;
+	}
+
+	FreeFile(file);
+
+	return buf.data;
+}
+
+/*
+ * Write a configuration file under a temporary name and rename it,
+ * so that a reload never sees a partial file.
+ * Returns false if that failed; the error is logged.
+ */
+bool
+write_config_file(const char *path, const char *contents)
+{
+	char *tmpfile = psprintf("%s.tmp", path);
+	FILE *file;
+
+	if ((file = AllocateFile(tmpfile, "w")) == NULL)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("cannot open \"%s\" for writing: %m", tmpfile)));
+		return false;
+	}
+
+	if (fwrite(contents, 1, strlen(contents), file) != strlen(contents))
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("error writing file \"%s\": %m", tmpfile)));
+		FreeFile(file);
+		(void) unlink(tmpfile);
+		return false;
+	}
+
+	if (FreeFile(file) != 0)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("error closing file \"%s\": %m", tmpfile)));
+		(void) unlink(tmpfile);
+		return false;
+	}
+
+	if (durable_rename(tmpfile, path, LOG) != 0)
+	{
+		(void) unlink(tmpfile);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Check that the configuration files include the schedule file and that
+ * no later setting overrides the scheduled ones, for example one set with
+ * ALTER SYSTEM.  Otherwise the scheduled limits would silently not apply.
+ * "pg_file_settings" parses the configuration files, so this does not
+ * depend on when the reload takes place.
+ */
+void
+verify_schedule(const char *path, int entries)
+{
+	StringInfoData query;
+	uint64 i;
+
+	if (entries == 0)
+		return;
+
+	initStringInfo(&query);
+	appendStringInfoString(&query,
+						   "SELECT name, applied, error"
+						   " FROM pg_catalog.pg_file_settings"
+						   " WHERE sourcefile = ");
+	appendStringInfoString(&query, quote_literal_cstr(path));
+
+	if (SPI_execute(query.data, true, 0) != SPI_OK_SELECT)
+		elog(ERROR, "cannot read \"pg_file_settings\"");
+
+	if (SPI_processed == 0)
+	{
+		ereport(WARNING,
+				(errcode(ERRCODE_CONFIG_FILE_ERROR),
+				 errmsg("the pg_cgroups schedule is not applied"),
+				 errdetail("The configuration files do not include \"%s\".", path),
+				 errhint("Add \"include_if_exists = '%s'\" at the end of \"postgresql.conf\".",
+						 path)));
+		return;
+	}
+
+	for (i=0; i<SPI_processed; ++i)
+	{
+		char *name = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1);
+		char *applied = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 2);
+		char *error = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 3);
+
+		if (strcmp(applied, "t") == 0)
+			continue;
+
+		if (error != NULL)
+			ereport(WARNING,
+					(errcode(ERRCODE_CONFIG_FILE_ERROR),
+					 errmsg("scheduled parameter \"%s\" is not applied", name),
+					 errdetail("%s", error)));
+		else
+			ereport(WARNING,
+					(errcode(ERRCODE_CONFIG_FILE_ERROR),
+					 errmsg("scheduled parameter \"%s\" is not applied", name),
+					 errdetail("The parameter is set again later in the configuration files."),
+					 errhint("Include \"%s\" after all other settings and remove the parameter from \"postgresql.auto.conf\" with ALTER SYSTEM RESET.",
+							 path)));
+	}
+}
+
+/*
+ * Write the settings of the active time windows to the schedule file
+ * and reload the configuration if they changed.
+ * If a setting is invalid, the file is left alone.
+ */
+void
+apply_schedule(void)
+{
+	StringInfoData query, contents;
+	char *schema, *path, *old_contents;
+	bool valid = true;
+	uint64 i;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "applying the pg_cgroups schedule");
+
+	if ((schema = extension_schema()) == NULL)
+	{
+		static bool warned = false;
+
+		if (!warned)
+			ereport(LOG,
+					(errcode(ERRCODE_UNDEFINED_OBJECT),
+					 errmsg("extension \"pg_cgroups\" is not installed in database \"%s\"",
+							schedule_database),
+					 errdetail("The scheduler needs the table \"pg_cgroups_schedule\".")));
+		warned = true;
+
+		SPI_finish();
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+		pgstat_report_activity(STATE_IDLE, NULL);
+
+		return;
+	}
+
+	/* the functions of the extension find the table on the search_path */
+	initStringInfo(&query);
+	appendStringInfo(&query, "SET LOCAL search_path = %s, pg_catalog", schema);
+	if (SPI_execute(query.data, false, 0) < 0)
+		elog(ERROR, "cannot set the search_path to the schema of extension \"pg_cgroups\"");
+
+	/*
+	 * The assign hook of "pg_cgroups.memory_limit" takes care of the order
+	 * in which the memory and swap limits are changed, as long as
+	 * "pg_cgroups.swap_limit" is processed after it, so it goes last.
+	 */
+	resetStringInfo(&query);
+	appendStringInfoString(&query,
+						   "SELECT a.parameter, a.value, s.context"
+						   " FROM pg_cgroups_active_schedule() AS a"
+						   "    LEFT JOIN pg_catalog.pg_settings AS s ON s.name = a.parameter"
+						   " ORDER BY a.parameter = 'pg_cgroups.swap_limit', a.parameter");
+
+	if (SPI_execute(query.data, true, 0) != SPI_OK_SELECT)
+		elog(ERROR, "cannot read the pg_cgroups schedule");
+
+	initStringInfo(&contents);
+	appendStringInfoString(&contents,
+						   "# Written by the pg_cgroups scheduler from the table\n"
+						   "# \"pg_cgroups_schedule\".  Do not edit this file.\n");
+
+	for (i=0; i<SPI_processed; ++i)
+	{
+		char *name = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1);
+		char *value = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 2);
+		char *context = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 3);
+
+		if (context == NULL)
+		{
+			ereport(WARNING,
+					(errcode(ERRCODE_UNDEFINED_OBJECT),
+					 errmsg("unrecognized configuration parameter \"%s\" in the pg_cgroups schedule",
+							name)));
+			valid = false;
+			continue;
+		}
+
+		/* only parameters that can change with a reload can be scheduled */
+		if (strcmp(context, "sighup") != 0
+			&& strcmp(context, "superuser") != 0
+			&& strcmp(context, "user") != 0)
+		{
+			ereport(WARNING,
+					(errcode(ERRCODE_CANT_CHANGE_RUNTIME_PARAM),
+					 errmsg("parameter \"%s\" in the pg_cgroups schedule cannot be changed with a reload",
+							name)));
+			valid = false;
+			continue;
+		}
+
+		/* check the value without setting it; this emits the warning */
+		if (set_config_option(name, value, PGC_SIGHUP, PGC_S_FILE,
+							  GUC_ACTION_SET, false, WARNING, false) <= 0)
+		{
+			valid = false;
+			continue;
+		}
+
+		appendStringInfo(&contents, "%s = ", name);
+		append_conf_value(&contents, value);
+		appendStringInfoChar(&contents, '\n');
+	}
+
+	path = psprintf("%s/%s", DataDir, SCHEDULE_FILE);
+
+	if (!valid)
+		ereport(WARNING,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("the pg_cgroups schedule contains invalid settings"),
+				 errdetail("The limits remain unchanged until the settings are fixed.")));
+	else
+	{
+		old_contents = read_schedule_file(path);
+
+		if (old_contents == NULL || strcmp(old_contents, contents.data) != 0)
+		{
+			if (write_config_file(path, contents.data))
+			{
+				ereport(LOG,
+						(errmsg("the pg_cgroups schedule changed, reloading the configuration")));
+
+				/* the postmaster applies the limits and signals its children */
+				if (kill(PostmasterPid, SIGHUP) != 0)
+					ereport(LOG,
+							(errmsg("cannot signal the postmaster: %m")));
+
+				verify_schedule(path, (int) SPI_processed);
+			}
+		}
+	}
+
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+void
+schedule_main(Datum main_arg)
+{
+	pqsignal(SIGHUP, schedule_sighup);
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+#if PG_VERSION_NUM >= 110000
+	BackgroundWorkerInitializeConnection(schedule_database, NULL, 0);
+#else
+	BackgroundWorkerInitializeConnection(schedule_database, NULL);
+#endif
+
+	for (;;)
+	{
+		int rc;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (got_sighup)
+		{
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		apply_schedule();
+
+		/* wake up at the start of the next minute */
+		rc = WaitLatch(MyLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   (60 - time(NULL) % 60) * 1000L,
+					   PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+	}
+}
@@ -4,6 +4,11 @@ SHOW pg_cgroups.cpu_share;
 -- this should fail
 ALTER SYSTEM SET pg_cgroups.cpu_share = 0;
 
+-- this should fail, since it is more than all online CPUs
+\set VERBOSITY terse
+ALTER SYSTEM SET pg_cgroups.cpu_share = 2000000000;
+\set VERBOSITY default
+
 -- allow 50% of the availabe CPU
 ALTER SYSTEM SET pg_cgroups.cpu_share = 50000;
 SELECT pg_reload_conf();
@@ -0,0 +1,21 @@
+-- check the default settings
+SHOW pg_cgroups.groups;
+SHOW pg_cgroups.group;
+SHOW pg_cgroups.role_groups;
+SHOW pg_cgroups.database_groups;
+SHOW pg_cgroups.autovacuum_group;
+
+-- these should fail
+SET pg_cgroups.group = 'reporting';
+ALTER SYSTEM SET pg_cgroups.freeze_groups = 'Reporting';
+ALTER SYSTEM SET pg_cgroups.freeze_groups = 'reporting';
+ALTER SYSTEM SET pg_cgroups.role_groups = 'alice';
+ALTER SYSTEM SET pg_cgroups.database_groups = 'tenant1 reporting';
+ALTER SYSTEM SET pg_cgroups.autovacuum_group = 'maintenance';
+ALTER SYSTEM SET pg_cgroups.autovacuum_io_utilization = 1.5;
+
+-- the SQL functions
+CREATE EXTENSION pg_cgroups;
+SELECT pg_cgroups_freeze('reporting');
+SELECT pg_cgroups_thaw('reporting');
+DROP EXTENSION pg_cgroups;
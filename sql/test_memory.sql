@@ -51,6 +51,21 @@ SHOW pg_cgroups.swap_limit;
 -- set memory limit to 0 (should fail)
 ALTER SYSTEM SET pg_cgroups.memory_limit = 0;
 
+-- set memory limit to a percentage of the RAM (should work)
+ALTER SYSTEM SET pg_cgroups.memory_limit = '10%';
+SELECT pg_reload_conf();
+SELECT pg_sleep_for('0.3');
+SHOW pg_cgroups.memory_limit;
+
+-- compute the memory limit (should work)
+ALTER SYSTEM SET pg_cgroups.memory_limit = 'auto';
+SELECT pg_reload_conf();
+SELECT pg_sleep_for('0.3');
+SHOW pg_cgroups.memory_limit;
+
+-- this should fail
+ALTER SYSTEM SET pg_cgroups.memory_limit = '200%';
+
 -- disable OOM killer (should work)
 ALTER SYSTEM SET pg_cgroups.oom_killer = off;
 SELECT pg_reload_conf();
@@ -66,3 +81,33 @@ SELECT pg_sleep_for('0.3');
 SHOW pg_cgroups.memory_limit;
 SHOW pg_cgroups.swap_limit;
 SHOW pg_cgroups.oom_killer;
+
+-- memory soft limit
+SHOW pg_cgroups.memory_soft_limit;
+
+-- these should fail
+ALTER SYSTEM SET pg_cgroups.memory_soft_limit = 'lots';
+ALTER SYSTEM SET pg_cgroups.memory_soft_limit = '-5';
+
+-- set a soft limit (should work)
+ALTER SYSTEM SET pg_cgroups.memory_soft_limit = '512MB';
+SELECT pg_reload_conf();
+SELECT pg_sleep_for('0.3');
+SHOW pg_cgroups.memory_soft_limit;
+
+-- compute the soft limit (should work)
+ALTER SYSTEM SET pg_cgroups.memory_soft_limit = 'auto';
+SELECT pg_reload_conf();
+SELECT pg_sleep_for('0.3');
+SHOW pg_cgroups.memory_soft_limit;
+
+-- reset
+ALTER SYSTEM RESET pg_cgroups.memory_soft_limit;
+SELECT pg_reload_conf();
+SELECT pg_sleep_for('0.3');
+SHOW pg_cgroups.memory_soft_limit;
+
+-- reclaiming a negative amount fails
+CREATE EXTENSION pg_cgroups;
+SELECT pg_cgroups_reclaim(-1);
+DROP EXTENSION pg_cgroups;
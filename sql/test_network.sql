@@ -0,0 +1,38 @@
+-- the temporary cluster has a replication group, and net_cls and net_prio
+-- share a hierarchy like with systemd
+SHOW pg_cgroups.replication_group;
+SHOW pg_cgroups.replication_net_priority;
+SHOW pg_cgroups.replication_classid;
+
+-- these should fail
+ALTER SYSTEM SET pg_cgroups.replication_net_priority = 'lo';
+ALTER SYSTEM SET pg_cgroups.replication_net_priority = 'nonexistent 5';
+ALTER SYSTEM SET pg_cgroups.replication_net_priority = 'lo high';
+ALTER SYSTEM SET pg_cgroups.replication_classid = '10';
+ALTER SYSTEM SET pg_cgroups.replication_classid = '10000:1';
+
+-- prioritize replication over the loopback interface and tag its packets
+ALTER SYSTEM SET pg_cgroups.replication_net_priority = 'lo 5';
+ALTER SYSTEM SET pg_cgroups.replication_classid = '10:1';
+SELECT pg_reload_conf();
+SELECT pg_sleep_for('0.3');
+SHOW pg_cgroups.replication_net_priority;
+SHOW pg_cgroups.replication_classid;
+SELECT pg_read_file(current_setting('pg_cgroups.system_root')
+          || '/sys/fs/cgroup/net_cls,net_prio/postgres/'
+          || split_part(pg_read_file('postmaster.pid'), E'\n', 1)
+          || '/replication/' || file) AS contents
+FROM (VALUES (1, 'net_prio.ifpriomap'), (2, 'net_cls.classid')) AS f(n, file)
+ORDER BY n;
+
+-- reset the priority and the class ID
+ALTER SYSTEM RESET pg_cgroups.replication_net_priority;
+ALTER SYSTEM RESET pg_cgroups.replication_classid;
+SELECT pg_reload_conf();
+SELECT pg_sleep_for('0.3');
+SELECT pg_read_file(current_setting('pg_cgroups.system_root')
+          || '/sys/fs/cgroup/net_cls,net_prio/postgres/'
+          || split_part(pg_read_file('postmaster.pid'), E'\n', 1)
+          || '/replication/' || file) AS contents
+FROM (VALUES (1, 'net_prio.ifpriomap'), (2, 'net_cls.classid')) AS f(n, file)
+ORDER BY n;
@@ -0,0 +1,33 @@
+-- check the default settings
+SHOW pg_cgroups.oom_score_adj;
+SHOW pg_cgroups.group_oom_score_adj;
+
+-- these should fail
+ALTER SYSTEM SET pg_cgroups.oom_score_adj = 'client';
+ALTER SYSTEM SET pg_cgroups.oom_score_adj = 'checkpointer 100';
+ALTER SYSTEM SET pg_cgroups.oom_score_adj = 'client 1001';
+ALTER SYSTEM SET pg_cgroups.oom_score_adj = 'client 100, client 200';
+ALTER SYSTEM SET pg_cgroups.group_oom_score_adj = 'reporting 500';
+
+-- new client backends get their value during authentication
+ALTER SYSTEM SET pg_cgroups.oom_score_adj = 'client 500';
+SELECT pg_reload_conf();
+SELECT pg_sleep_for('0.3');
+\c -
+SELECT pg_read_file('/proc/' || pg_backend_pid() || '/oom_score_adj', 0, 12)::integer
+       AS oom_score_adj;
+
+-- without an entry for them, client backends don't keep the value
+-- that PostgreSQL sets in all processes it starts
+ALTER SYSTEM SET pg_cgroups.oom_score_adj = 'auxiliary 300';
+SELECT pg_reload_conf();
+SELECT pg_sleep_for('0.3');
+\c -
+SELECT pg_read_file('/proc/' || pg_backend_pid() || '/oom_score_adj', 0, 12)::integer
+       <> 300 AS not_auxiliary;
+
+-- reset
+ALTER SYSTEM RESET pg_cgroups.oom_score_adj;
+SELECT pg_reload_conf();
+SELECT pg_sleep_for('0.3');
+SHOW pg_cgroups.oom_score_adj;
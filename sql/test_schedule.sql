@@ -0,0 +1,23 @@
+-- check the default setting
+SHOW pg_cgroups.schedule_database;
+
+CREATE EXTENSION pg_cgroups;
+
+-- these should fail
+INSERT INTO pg_cgroups_schedule VALUES ('02:00', '02:00', 'pg_cgroups.cpu_share', '400000');
+INSERT INTO pg_cgroups_schedule VALUES ('02:00', '05:00', 'work_mem', '1GB');
+
+-- a batch window, business hours and a window across midnight
+INSERT INTO pg_cgroups_schedule VALUES
+   ('02:00', '05:00', 'pg_cgroups.cpu_share', '400000'),
+   ('02:00', '05:00', 'pg_cgroups.memory_limit', '8192'),
+   ('08:00', '18:00', 'pg_cgroups.group_max_processes', 'reporting 5'),
+   ('22:00', '06:00', 'pg_cgroups.cpu_share', '200000');
+
+SELECT * FROM pg_cgroups_active_schedule('01:00') ORDER BY parameter;
+SELECT * FROM pg_cgroups_active_schedule('03:00') ORDER BY parameter;
+SELECT * FROM pg_cgroups_active_schedule('05:00') ORDER BY parameter;
+SELECT * FROM pg_cgroups_active_schedule('12:00') ORDER BY parameter;
+SELECT * FROM pg_cgroups_active_schedule('18:00') ORDER BY parameter;
+
+DROP EXTENSION pg_cgroups;
@@ -0,0 +1,48 @@
+CREATE EXTENSION pg_cgroups;
+
+-- verify the control group parameters every second
+ALTER SYSTEM SET pg_cgroups.verify_interval = '1s';
+ALTER SYSTEM SET pg_cgroups.cpu_share = 50000;
+SELECT pg_reload_conf();
+SELECT pg_sleep_for('2.5');
+
+-- the kernel agrees with the settings
+SELECT count(*) FROM pg_cgroups_drift;
+SELECT expected, observed, reapplied FROM pg_cgroups_verification()
+WHERE group_name IS NULL AND parameter = 'cpu.cfs_quota_us';
+
+-- somebody else changes the CPU quota in the simulated file system
+DO $$DECLARE
+   root text := current_setting('pg_cgroups.system_root');
+BEGIN
+   EXECUTE format(
+      'COPY (SELECT 20000) TO %L',
+      root
+      || substring(pg_read_file(root || '/proc/mounts')
+                   FROM ' (\S*) cgroup \S*\mcpu\M')
+      || '/postgres/'
+      || split_part(pg_read_file('postmaster.pid'), E'\n', 1)
+      || '/cpu.cfs_quota_us'
+   );
+END;$$;
+SELECT pg_sleep_for('2.5');
+SELECT group_name, parameter, device, expected, observed, reapplied
+FROM pg_cgroups_drift;
+
+-- write the expected value again
+ALTER SYSTEM SET pg_cgroups.reapply_drift = on;
+SELECT pg_reload_conf();
+SELECT pg_sleep_for('2.5');
+SELECT count(*) FROM pg_cgroups_drift;
+SELECT expected, observed, reapplied FROM pg_cgroups_verification()
+WHERE group_name IS NULL AND parameter = 'cpu.cfs_quota_us';
+
+-- reset
+ALTER SYSTEM RESET pg_cgroups.verify_interval;
+ALTER SYSTEM RESET pg_cgroups.reapply_drift;
+ALTER SYSTEM RESET pg_cgroups.cpu_share;
+SELECT pg_reload_conf();
+SELECT pg_sleep_for('0.3');
+SHOW pg_cgroups.cpu_share;
+
+DROP EXTENSION pg_cgroups;
@@ -0,0 +1,835 @@
+#ifndef __linux__
+#error "Linux control groups are only available on Linux"
+#endif
+
+#include "postgres.h"
+
+#include "access/parallel.h"
+#include "executor/executor.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "postmaster/autovacuum.h"
+#include "replication/walsender.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "tcop/utility.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/timeout.h"
+#include "utils/timestamp.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pg_cgroups.h"
+
+/*
+ * Limits on the resources that a single statement can consume.
+ * The timeout infrastructure calls a handler periodically while a
+ * statement is executing, and the handler compares the resource usage
+ * of the statement with the limits.  If a limit is exceeded, the handler
+ * cancels the statement, and the executor hooks replace the generic
+ * cancellation error with a more helpful one.
+ *
+ * Only top level statements are limited, and everything that they
+ * execute counts toward their limits.  Like pg_stat_statements, we count
+ * the nesting of utility statements and executor calls to tell them apart.
+ * A statement can run in several steps, for example if the client fetches
+ * the rows of a portal in batches, so the usage is kept with the portal's
+ * QueryDesc and accumulated over the steps.
+ *
+ * Parallel workers run the same timeout and add their resource usage
+ * to a slot in shared memory that belongs to their leader, and the
+ * leader counts it against the limits of the statement.
+ *
+ * This requires periodic timeouts, which were introduced in v14.
+ */
+
+#if PG_VERSION_NUM >= 140000
+
+/* GUCs for the statement limits */
+static int statement_cpu_limit = -1;
+static int statement_io_limit = -1;
+
+/* which limit was exceeded */
+#define LIMIT_NONE 0
+#define LIMIT_CPU  1
+#define LIMIT_IO   2
+
+/*
+ * The resource usage of the parallel workers of a leader, indexed by
+ * the leader's PGPROC number.  The counters only grow, and the leader
+ * remembers their values at the start of a step.  The atomic operations
+ * are lock-free, so they can be used in the timeout handlers.
+ */
+typedef struct
+{
+	pg_atomic_uint64 cpu_time;	/* in microseconds */
+	pg_atomic_uint64 read_bytes;
+	pg_atomic_uint64 write_bytes;
+} WorkerUsage;
+
+static WorkerUsage *worker_usage = NULL;
+static int num_worker_usage = 0;	/* set during module initialization */
+
+/*
+ * The resources that a top level statement used in the steps that
+ * are finished.  Statements that run in the executor have one in their
+ * executor state, and it is removed from "budgets" when that is freed.
+ * Utility statements run in a single step and use "utility_budget".
+ */
+typedef struct StatementBudget
+{
+	QueryDesc *queryDesc;		/* NULL for a utility statement */
+	int64_t cpu_time;		/* in microseconds */
+	int64_t read_bytes;
+	int64_t write_bytes;
+	struct StatementBudget *next;
+	MemoryContextCallback callback;
+} StatementBudget;
+
+static StatementBudget *budgets = NULL;
+static StatementBudget utility_budget;
+
+#if PG_VERSION_NUM >= 170000
+#define PROC_NUMBER(proc) GetNumberFromPGProc(proc)
+#else
+#define PROC_NUMBER(proc) ((proc)->pgprocno)
+#endif
+
+/* saved hook values */
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static ProcessUtility_hook_type prev_ProcessUtility = NULL;
+static ExecutorStart_hook_type prev_ExecutorStart = NULL;
+static ExecutorRun_hook_type prev_ExecutorRun = NULL;
+static ExecutorFinish_hook_type prev_ExecutorFinish = NULL;
+static ExecutorEnd_hook_type prev_ExecutorEnd = NULL;
+
+/* current nesting depth of ProcessUtility, ExecutorRun and ExecutorFinish calls */
+static int nesting_level = 0;
+
+/* the budget of the step that is running in a leader, NULL if none */
+static StatementBudget * volatile running = NULL;
+
+/* state of the limit check for the current step or parallel worker */
+static bool timeout_registered = false;
+static TimeoutId limit_timeout;
+static bool timeout_active = false;
+static int64_t start_cpu_time;		/* in microseconds */
+static int64_t start_read_bytes;
+static int64_t start_write_bytes;
+static bool check_io = false;	/* false if the I/O counters are unavailable */
+static WorkerUsage *usage_slot = NULL;	/* of the leader, NULL if none */
+static int64_t start_worker_cpu_time;	/* slot values at the start of a step */
+static int64_t start_worker_read_bytes;
+static int64_t start_worker_write_bytes;
+static int64_t reported_cpu_time;	/* what a worker has added to the slot */
+static int64_t reported_read_bytes;
+static int64_t reported_write_bytes;
+
+/* set by the timeout handler */
+static volatile sig_atomic_t limit_exceeded = LIMIT_NONE;
+static volatile int64_t cpu_time_used;	/* in milliseconds */
+static volatile int64_t read_bytes_used;
+static volatile int64_t write_bytes_used;
+
+/* static functions declarations */
+#if PG_VERSION_NUM >= 150000
+static void limits_shmem_request(void);
+#endif
+static void limits_shmem_startup(void);
+static WorkerUsage *leader_slot(void);
+static void report_worker_usage(void);
+static int64_t cpu_time(void);
+static bool io_bytes(int64_t *read_bytes, int64_t *write_bytes);
+static bool limits_set(void);
+static void start_measuring(void);
+static void enable_limit_timeout(void);
+static StatementBudget *find_budget(QueryDesc *queryDesc);
+static void forget_budget(void *arg);
+static void start_step(StatementBudget *budget);
+static bool step_usage(int64_t *used, int64_t *read_bytes, int64_t *write_bytes);
+static void end_step(void);
+static void limit_timeout_handler(void);
+static void limit_error(void);
+static void limits_ProcessUtility(PlannedStmt *pstmt, const char *queryString,
+								  bool readOnlyTree, ProcessUtilityContext context,
+								  ParamListInfo params, QueryEnvironment *queryEnv,
+								  DestReceiver *dest, QueryCompletion *qc);
+static void limits_ExecutorStart(QueryDesc *queryDesc, int eflags);
+static void limits_ExecutorRun(QueryDesc *queryDesc, ScanDirection direction,
+							   uint64 count, bool execute_once);
+static void limits_ExecutorFinish(QueryDesc *queryDesc);
+static void limits_ExecutorEnd(QueryDesc *queryDesc);
+
+/*
+ * Define the GUCs and install the hooks.
+ * This is called from _PG_init().
+ */
+void
+statement_limits_init(void)
+{
+	DefineCustomIntVariable(
+		"pg_cgroups.statement_cpu_limit",
+		"Limit the CPU time that a statement can consume.",
+		"A statement that uses more CPU time is canceled.",
+		&statement_cpu_limit,
+		-1,
+		-1,
+		INT_MAX,
+		PGC_SUSET,
+		GUC_UNIT_MS,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"pg_cgroups.statement_io_limit",
+		"Limit the data that a statement can read from and write to storage.",
+		"A statement that reads and writes more is canceled.",
+		&statement_io_limit,
+		-1,
+		-1,
+		INT_MAX,
+		PGC_SUSET,
+		GUC_UNIT_MB,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	/*
+	 * Only backends and background workers lead parallel workers, and
+	 * they have the first PGPROCs.  Before v15, "MaxBackends" is not yet
+	 * known here, so compute it the same way.
+	 */
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = limits_shmem_request;
+#else
+	num_worker_usage = MaxConnections + autovacuum_max_workers + 1
+					   + max_worker_processes + max_wal_senders;
+	RequestAddinShmemSpace(MAXALIGN(mul_size(num_worker_usage, sizeof(WorkerUsage))));
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = limits_shmem_startup;
+
+	prev_ProcessUtility = ProcessUtility_hook;
+	ProcessUtility_hook = limits_ProcessUtility;
+	prev_ExecutorStart = ExecutorStart_hook;
+	ExecutorStart_hook = limits_ExecutorStart;
+	prev_ExecutorRun = ExecutorRun_hook;
+	ExecutorRun_hook = limits_ExecutorRun;
+	prev_ExecutorFinish = ExecutorFinish_hook;
+	ExecutorFinish_hook = limits_ExecutorFinish;
+	prev_ExecutorEnd = ExecutorEnd_hook;
+	ExecutorEnd_hook = limits_ExecutorEnd;
+}
+
+#if PG_VERSION_NUM >= 150000
+void
+limits_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	num_worker_usage = MaxBackends;
+	RequestAddinShmemSpace(MAXALIGN(mul_size(num_worker_usage, sizeof(WorkerUsage))));
+}
+#endif
+
+void
+limits_shmem_startup(void)
+{
+	bool found;
+	int i;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	worker_usage = ShmemInitStruct("pg_cgroups statement limits",
+								   mul_size(num_worker_usage, sizeof(WorkerUsage)),
+								   &found);
+	if (!found)
+		for (i=0; i<num_worker_usage; ++i)
+		{
+			pg_atomic_init_u64(&worker_usage[i].cpu_time, 0);
+			pg_atomic_init_u64(&worker_usage[i].read_bytes, 0);
+			pg_atomic_init_u64(&worker_usage[i].write_bytes, 0);
+		}
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * The slot for the parallel workers of this process, or of the leader
+ * if this is a parallel worker.  Returns NULL if there is none.
+ */
+WorkerUsage *
+leader_slot(void)
+{
+	PGPROC *leader = IsParallelWorker() ? MyProc->lockGroupLeader : MyProc;
+	int procno;
+
+	if (worker_usage == NULL || leader == NULL)
+		return NULL;
+
+	procno = PROC_NUMBER(leader);
+	if (procno < 0 || procno >= num_worker_usage)
+		return NULL;
+
+	return &worker_usage[procno];
+}
+
+/*
+ * A parallel worker adds the resources it used since the last report
+ * to its leader's slot.
+ * This is safe to call from a signal handler.
+ */
+void
+report_worker_usage(void)
+{
+	int64_t used, read_bytes, write_bytes;
+
+	if (usage_slot == NULL)
+		return;
+
+	used = cpu_time() - start_cpu_time;
+	if (used > reported_cpu_time)
+	{
+		pg_atomic_fetch_add_u64(&usage_slot->cpu_time, used - reported_cpu_time);
+		reported_cpu_time = used;
+	}
+
+	if (check_io && io_bytes(&read_bytes, &write_bytes))
+	{
+		read_bytes -= start_read_bytes;
+		write_bytes -= start_write_bytes;
+
+		if (read_bytes > reported_read_bytes)
+		{
+			pg_atomic_fetch_add_u64(&usage_slot->read_bytes,
+									read_bytes - reported_read_bytes);
+			reported_read_bytes = read_bytes;
+		}
+		if (write_bytes > reported_write_bytes)
+		{
+			pg_atomic_fetch_add_u64(&usage_slot->write_bytes,
+									write_bytes - reported_write_bytes);
+			reported_write_bytes = write_bytes;
+		}
+	}
+}
+
+/*
+ * CPU time consumed by this process in microseconds.
+ * This is safe to call from a signal handler.
+ */
+int64_t
+cpu_time(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == -1)
+		return 0;
+
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Bytes that this process caused to be read from and written to storage,
+ * from "/proc/self/io".  Unlike the blkio counters, these are per process.
+ * This is safe to call from a signal handler, so it cannot use stdio.
+ * Returns false if the counters are not available.
+ */
+bool
+io_bytes(int64_t *read_bytes, int64_t *write_bytes)
+{
+	char buf[512], *p;
+	int fd;
+	ssize_t len;
+	bool found_read = false, found_write = false;
+
+	if ((fd = open("/proc/self/io", O_RDONLY)) == -1)
+		return false;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return false;
+	buf[len] = '\0';
+
+	/* lines have the form "key: value" */
+	for (p = buf; *p != '\0'; )
+	{
+		int64_t *target = NULL;
+
+		if (strncmp(p, "read_bytes: ", 12) == 0)
+		{
+			target = read_bytes;
+			found_read = true;
+			p += 12;
+		}
+		else if (strncmp(p, "write_bytes: ", 13) == 0)
+		{
+			target = write_bytes;
+			found_write = true;
+			p += 13;
+		}
+
+		if (target != NULL)
+		{
+			*target = 0;
+			while (*p >= '0' && *p <= '9')
+				*target = *target * 10 + (*p++ - '0');
+		}
+
+		/* skip to the next line */
+		while (*p != '\0' && *p++ != '\n')
+			;
+	}
+
+	return found_read && found_write;
+}
+
+/*
+ * Are any limits set?
+ */
+bool
+limits_set(void)
+{
+	return statement_cpu_limit != -1 || statement_io_limit != -1;
+}
+
+/*
+ * Remember the resource usage of this process and of the parallel
+ * workers of its leader.
+ */
+void
+start_measuring(void)
+{
+	limit_exceeded = LIMIT_NONE;
+	start_cpu_time = cpu_time();
+
+	/* without the counters at the start, the I/O cannot be measured */
+	check_io = (statement_io_limit != -1
+				&& io_bytes(&start_read_bytes, &start_write_bytes));
+	if (statement_io_limit != -1 && !check_io)
+		elog(DEBUG1, "cannot read \"/proc/self/io\", the I/O limit is not checked");
+
+	usage_slot = leader_slot();
+	if (IsParallelWorker())
+		reported_cpu_time = reported_read_bytes = reported_write_bytes = 0;
+	else if (usage_slot != NULL)
+	{
+		start_worker_cpu_time = (int64_t) pg_atomic_read_u64(&usage_slot->cpu_time);
+		start_worker_read_bytes = (int64_t) pg_atomic_read_u64(&usage_slot->read_bytes);
+		start_worker_write_bytes = (int64_t) pg_atomic_read_u64(&usage_slot->write_bytes);
+	}
+}
+
+void
+enable_limit_timeout(void)
+{
+	int interval = 100;
+
+	if (!timeout_registered)
+	{
+		limit_timeout = RegisterTimeout(USER_TIMEOUT, limit_timeout_handler);
+		timeout_registered = true;
+	}
+
+	/* check ten times per CPU limit, but at least every 100 ms */
+	if (statement_cpu_limit != -1)
+		interval = Max(Min(statement_cpu_limit / 10, 100), 1);
+
+	enable_timeout_every(limit_timeout,
+						 TimestampTzPlusMilliseconds(GetCurrentTimestamp(), interval),
+						 interval);
+	timeout_active = true;
+}
+
+/*
+ * The budget of a top level statement that runs in the executor,
+ * or NULL if it has none.
+ */
+StatementBudget *
+find_budget(QueryDesc *queryDesc)
+{
+	StatementBudget *budget;
+
+	for (budget = budgets; budget != NULL; budget = budget->next)
+		if (budget->queryDesc == queryDesc)
+			return budget;
+
+	return NULL;
+}
+
+/*
+ * Memory context callback that removes a budget from the list
+ * when the executor state is freed, even if the statement failed.
+ */
+void
+forget_budget(void *arg)
+{
+	StatementBudget **prev;
+
+	for (prev = &budgets; *prev != NULL; prev = &(*prev)->next)
+		if (*prev == (StatementBudget *) arg)
+		{
+			*prev = (*prev)->next;
+			break;
+		}
+}
+
+/*
+ * Start checking the limits while a step of a top level statement runs.
+ */
+void
+start_step(StatementBudget *budget)
+{
+	start_measuring();
+	running = budget;
+	enable_limit_timeout();
+}
+
+/*
+ * The resources used since the start of the step by this process and
+ * the parallel workers of the statement.  Returns false if the I/O is
+ * not measured.
+ * This is safe to call from a signal handler.
+ */
+bool
+step_usage(int64_t *used, int64_t *read_bytes, int64_t *write_bytes)
+{
+	bool io_valid;
+
+	*used = cpu_time() - start_cpu_time;
+	if (usage_slot != NULL)
+		*used += (int64_t) pg_atomic_read_u64(&usage_slot->cpu_time)
+				 - start_worker_cpu_time;
+
+	io_valid = (check_io && io_bytes(read_bytes, write_bytes));
+	if (io_valid)
+	{
+		*read_bytes -= start_read_bytes;
+		*write_bytes -= start_write_bytes;
+
+		if (usage_slot != NULL)
+		{
+			*read_bytes += (int64_t) pg_atomic_read_u64(&usage_slot->read_bytes)
+						   - start_worker_read_bytes;
+			*write_bytes += (int64_t) pg_atomic_read_u64(&usage_slot->write_bytes)
+							- start_worker_write_bytes;
+		}
+	}
+
+	return io_valid;
+}
+
+/*
+ * Stop checking the limits and add the usage of the step to the budget.
+ * This is also called if the step fails.
+ */
+void
+end_step(void)
+{
+	StatementBudget *budget = running;
+	int64_t used, read_bytes, write_bytes;
+
+	if (budget == NULL)
+		return;
+
+	disable_timeout(limit_timeout, false);
+	timeout_active = false;
+	running = NULL;
+
+	if (step_usage(&used, &read_bytes, &write_bytes))
+	{
+		budget->read_bytes += read_bytes;
+		budget->write_bytes += write_bytes;
+	}
+	budget->cpu_time += used;
+}
+
+/*
+ * This runs in a signal handler, so we can only set flags.
+ * Cancel the statement like StatementTimeoutHandler() does.
+ * Parallel workers only report their usage, and the leader
+ * cancels the statement.
+ */
+void
+limit_timeout_handler(void)
+{
+	StatementBudget *budget = running;
+	int exceeded = LIMIT_NONE;
+	int64_t used, read_bytes, write_bytes;
+	bool io_valid;
+
+	if (IsParallelWorker())
+	{
+		report_worker_usage();
+		return;
+	}
+
+	if (budget == NULL)
+		return;
+
+	io_valid = step_usage(&used, &read_bytes, &write_bytes);
+
+	if (statement_cpu_limit != -1)
+	{
+		used = (budget->cpu_time + used) / 1000;
+
+		if (used > statement_cpu_limit)
+		{
+			cpu_time_used = used;
+			exceeded = LIMIT_CPU;
+		}
+	}
+
+	if (exceeded == LIMIT_NONE && io_valid)
+	{
+		read_bytes += budget->read_bytes;
+		write_bytes += budget->write_bytes;
+
+		if (read_bytes + write_bytes > (int64_t) statement_io_limit * 1024 * 1024)
+		{
+			read_bytes_used = read_bytes;
+			write_bytes_used = write_bytes;
+			exceeded = LIMIT_IO;
+		}
+	}
+
+	if (exceeded != LIMIT_NONE)
+	{
+		limit_exceeded = exceeded;
+		QueryCancelPending = true;
+		InterruptPending = true;
+	}
+}
+
+/*
+ * Called in a PG_CATCH block.  If the error is the cancellation caused
+ * by a limit, replace it with an error that tells which limit was hit.
+ */
+void
+limit_error(void)
+{
+	ErrorData *edata;
+	int exceeded = limit_exceeded;
+
+	if (exceeded == LIMIT_NONE)
+		return;
+
+	edata = CopyErrorData();
+	if (edata->sqlerrcode != ERRCODE_QUERY_CANCELED)
+	{
+		FreeErrorData(edata);
+		return;
+	}
+
+	FreeErrorData(edata);
+	FlushErrorState();
+
+	/* don't replace the error again in outer executor calls */
+	limit_exceeded = LIMIT_NONE;
+
+	if (exceeded == LIMIT_CPU)
+		ereport(ERROR,
+				(errcode(ERRCODE_QUERY_CANCELED),
+				 errmsg("canceling statement due to CPU time limit"),
+				 errdetail("The statement used %ld ms of CPU time, but \"pg_cgroups.statement_cpu_limit\" is %d ms.",
+						   (long) cpu_time_used, statement_cpu_limit)));
+	else
+		ereport(ERROR,
+				(errcode(ERRCODE_QUERY_CANCELED),
+				 errmsg("canceling statement due to I/O limit"),
+				 errdetail("The statement read %ld MB and wrote %ld MB, but \"pg_cgroups.statement_io_limit\" is %d MB.",
+						   (long) (read_bytes_used / (1024 * 1024)),
+						   (long) (write_bytes_used / (1024 * 1024)),
+						   statement_io_limit)));
+}
+
+/*
+ * A top level utility statement like DO, CALL or CREATE TABLE AS
+ * is limited as a whole, including the statements it executes.
+ */
+void
+limits_ProcessUtility(PlannedStmt *pstmt, const char *queryString,
+					  bool readOnlyTree, ProcessUtilityContext context,
+					  ParamListInfo params, QueryEnvironment *queryEnv,
+					  DestReceiver *dest, QueryCompletion *qc)
+{
+	MemoryContext oldcontext = CurrentMemoryContext;
+	bool top_level = (nesting_level == 0 && !IsParallelWorker() && limits_set());
+
+	if (top_level)
+	{
+		memset(&utility_budget, 0, sizeof(StatementBudget));
+		start_step(&utility_budget);
+	}
+
+	nesting_level++;
+	PG_TRY();
+	{
+		if (prev_ProcessUtility)
+			prev_ProcessUtility(pstmt, queryString, readOnlyTree, context,
+								params, queryEnv, dest, qc);
+		else
+			standard_ProcessUtility(pstmt, queryString, readOnlyTree, context,
+									params, queryEnv, dest, qc);
+	}
+	PG_CATCH();
+	{
+		nesting_level--;
+		if (top_level)
+			end_step();
+		MemoryContextSwitchTo(oldcontext);
+		limit_error();
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	nesting_level--;
+
+	if (top_level)
+		end_step();
+}
+
+void
+limits_ExecutorStart(QueryDesc *queryDesc, int eflags)
+{
+	/* a parallel worker checks the limits for its whole query */
+	if (nesting_level == 0 && IsParallelWorker() && limits_set())
+	{
+		start_measuring();
+		enable_limit_timeout();
+	}
+
+	if (prev_ExecutorStart)
+		prev_ExecutorStart(queryDesc, eflags);
+	else
+		standard_ExecutorStart(queryDesc, eflags);
+
+	/* a top level statement gets a budget that lives as long as its portal */
+	if (nesting_level == 0 && !IsParallelWorker() && limits_set())
+	{
+		MemoryContext cxt = queryDesc->estate->es_query_cxt;
+		StatementBudget *budget;
+
+		budget = (StatementBudget *) MemoryContextAllocZero(cxt, sizeof(StatementBudget));
+		budget->queryDesc = queryDesc;
+		budget->callback.func = forget_budget;
+		budget->callback.arg = budget;
+		MemoryContextRegisterResetCallback(cxt, &budget->callback);
+
+		budget->next = budgets;
+		budgets = budget;
+	}
+}
+
+void
+limits_ExecutorRun(QueryDesc *queryDesc, ScanDirection direction,
+				   uint64 count, bool execute_once)
+{
+	MemoryContext oldcontext = CurrentMemoryContext;
+	StatementBudget *budget = NULL;
+
+	if (nesting_level == 0 && (budget = find_budget(queryDesc)) != NULL)
+		start_step(budget);
+
+	nesting_level++;
+	PG_TRY();
+	{
+		if (prev_ExecutorRun)
+			prev_ExecutorRun(queryDesc, direction, count, execute_once);
+		else
+			standard_ExecutorRun(queryDesc, direction, count, execute_once);
+	}
+	PG_CATCH();
+	{
+		nesting_level--;
+		if (budget != NULL)
+			end_step();
+		MemoryContextSwitchTo(oldcontext);
+		limit_error();
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	nesting_level--;
+
+	if (budget != NULL)
+		end_step();
+}
+
+void
+limits_ExecutorFinish(QueryDesc *queryDesc)
+{
+	MemoryContext oldcontext = CurrentMemoryContext;
+	StatementBudget *budget = NULL;
+
+	if (nesting_level == 0 && (budget = find_budget(queryDesc)) != NULL)
+		start_step(budget);
+
+	nesting_level++;
+	PG_TRY();
+	{
+		if (prev_ExecutorFinish)
+			prev_ExecutorFinish(queryDesc);
+		else
+			standard_ExecutorFinish(queryDesc);
+	}
+	PG_CATCH();
+	{
+		nesting_level--;
+		if (budget != NULL)
+			end_step();
+		MemoryContextSwitchTo(oldcontext);
+		limit_error();
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	nesting_level--;
+
+	if (budget != NULL)
+		end_step();
+}
+
+void
+limits_ExecutorEnd(QueryDesc *queryDesc)
+{
+	/*
+	 * A parallel worker stops checking at the end of its query and
+	 * reports what it used since the last check.  If the query fails,
+	 * all timeouts are disabled anyway.
+	 */
+	if (nesting_level == 0 && timeout_active && IsParallelWorker())
+	{
+		disable_timeout(limit_timeout, false);
+		timeout_active = false;
+		report_worker_usage();
+	}
+
+	if (prev_ExecutorEnd)
+		prev_ExecutorEnd(queryDesc);
+	else
+		standard_ExecutorEnd(queryDesc);
+}
+
+#else
+
+void
+statement_limits_init(void)
+{
+}
+
+#endif  /* PG_VERSION_NUM */
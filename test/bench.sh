@@ -0,0 +1,277 @@
+#!/bin/sh
+#
+# Benchmark the overhead of pg_cgroups and how accurately it enforces limits.
+#
+# Usage: bench.sh [options] directory
+#
+# The script creates a temporary cluster in "directory" with the
+# PostgreSQL binaries from "pg_config --bindir", which must have
+# pg_cgroups installed.  The results are written to standard output,
+# one JSON object per line, like
+#
+#   {"benchmark": "connect", "variant": "group", "metric": "latency", "value": 1.52, "unit": "ms"}
+#
+# Progress messages go to standard error.
+#
+# Options:
+#   --fake              use a simulated control group file system
+#                       (see fake_cgroupfs.sh); the enforcement benchmarks
+#                       are skipped, since nothing is enforced
+#   --scale N           pgbench scale factor (default 50)
+#   --time SECONDS      duration of each pgbench run (default 10)
+#   --clients N         pgbench clients (default: number of CPUs)
+#   --groups "N ..."    group counts for the startup and reload
+#                       benchmarks (default "1 10 100")
+#   --port PORT         port of the temporary cluster (default 54329)
+
+set -e
+
+fake=no
+scale=50
+duration=10
+clients=$(nproc)
+group_counts="1 10 100"
+port=54329
+
+while [ $# -gt 1 ]; do
+	case "$1" in
+		--fake) fake=yes; shift;;
+		--scale) scale="$2"; shift 2;;
+		--time) duration="$2"; shift 2;;
+		--clients) clients="$2"; shift 2;;
+		--groups) group_counts="$2"; shift 2;;
+		--port) port="$2"; shift 2;;
+		*) echo "unknown option \"$1\"" >&2; exit 1;;
+	esac
+done
+
+if [ $# -ne 1 ]; then
+	echo "usage: $0 [options] directory" >&2
+	exit 1
+fi
+
+dir="$1"
+bindir=$(pg_config --bindir)
+datadir="$dir/data"
+logfile="$dir/postgresql.log"
+
+if [ -e "$dir" ]; then
+	echo "\"$dir\" already exists" >&2
+	exit 1
+fi
+
+# helper functions
+
+log() {
+	echo "$@" >&2
+}
+
+# print a result as a JSON object
+result() {
+	printf '{"benchmark": "%s", "variant": "%s", "metric": "%s", "value": %s, "unit": "%s"}\n' \
+		"$1" "$2" "$3" "$4" "$5"
+}
+
+sql() {
+	"$bindir/psql" -X -q -A -t -v ON_ERROR_STOP=1 -p $port -d postgres -c "$1"
+}
+
+now_ms() {
+	echo $(($(date +%s%N) / 1000000))
+}
+
+# "x / y" with three decimal places
+ratio() {
+	awk "BEGIN { printf \"%.3f\", $1 / $2 }"
+}
+
+start() {
+	"$bindir/pg_ctl" -w -s -D "$datadir" -l "$logfile" -o "-p $port" start
+}
+
+stop() {
+	"$bindir/pg_ctl" -w -s -D "$datadir" -m fast stop
+}
+
+# reload the configuration and wait until new sessions see it
+reload_conf() {
+	loaded=$(sql "SELECT pg_conf_load_time()")
+	sql "SELECT pg_reload_conf()" >/dev/null
+	while [ "$(sql "SELECT pg_conf_load_time() > '$loaded'")" != t ]; do
+		sleep 0.01
+	done
+}
+
+# set a parameter and wait until new sessions see the value
+reload() {
+	sql "ALTER SYSTEM SET $1 = '$2'"
+	reload_conf
+}
+
+reset() {
+	sql "ALTER SYSTEM RESET $1"
+	reload_conf
+}
+
+# run pgbench and print the TPS and the average latency in ms
+pgbench_run() {
+	"$bindir/pgbench" -n -p $port -T $duration "$@" postgres 2>&1 \
+		| awk '/^tps = / { tps = $3 } /^latency average = / { lat = $4 }
+			   END { if (tps == "") print "null", "null"; else print tps, lat }'
+}
+
+has_param() {
+	sql "SELECT 1 FROM pg_settings WHERE name = '$1'" | grep -q 1
+}
+
+trap 'stop 2>/dev/null || true' EXIT
+
+# set up the cluster
+
+mkdir -p "$dir"
+
+"$bindir/initdb" -N -A trust -D "$datadir" >"$dir/initdb.log"
+
+cat >>"$datadir/postgresql.conf" <<EOF
+shared_preload_libraries = 'pg_cgroups'
+max_connections = $(($clients + 20))
+EOF
+
+if [ $fake = yes ]; then
+	$(dirname "$0")/fake_cgroupfs.sh "$dir/cgroupfs"
+	echo "pg_cgroups.system_root = '$dir/cgroupfs'" >>"$datadir/postgresql.conf"
+fi
+
+start
+
+log "initializing pgbench tables with scale $scale"
+"$bindir/pgbench" -i -q -s $scale -p $port postgres >"$dir/pgbench-init.log" 2>&1
+sql "CREATE EXTENSION pg_cgroups"
+
+echo 'SELECT 1;' >"$dir/select1.sql"
+
+# startup and reload time as the number of groups grows
+
+for n in $group_counts; do
+	log "startup and reload with $n groups"
+
+	groups=$(seq -s ', ' -f 'g%.0f' 1 $n)
+	sql "ALTER SYSTEM SET pg_cgroups.groups = '$groups'"
+
+	stop
+	t0=$(now_ms)
+	start
+	result startup "groups=$n" time $(($(now_ms) - t0)) ms
+
+	if has_param pg_cgroups.group_io_weight; then
+		weights=$(seq -s ', ' -f 'g%.0f 100' 1 $n)
+		t0=$(now_ms)
+		reload pg_cgroups.group_io_weight "$weights"
+		result reload "groups=$n" time $(($(now_ms) - t0)) ms
+		reset pg_cgroups.group_io_weight
+	fi
+done
+
+# connection setup latency with and without placement in a group
+
+log "connection setup"
+
+sql "ALTER SYSTEM SET pg_cgroups.groups = 'bench'"
+stop
+start
+
+set -- $(pgbench_run -C -c $clients -j $clients -f "$dir/select1.sql")
+result connect no_group tps $1 tps
+result connect no_group latency $2 ms
+
+sql "ALTER ROLE CURRENT_USER SET pg_cgroups.group = 'bench'"
+set -- $(pgbench_run -C -c $clients -j $clients -f "$dir/select1.sql")
+result connect group tps $1 tps
+result connect group latency $2 ms
+sql "ALTER ROLE CURRENT_USER RESET pg_cgroups.group"
+
+# cost of sampling the cgroup counters
+
+log "sampling"
+
+for interval in 3600000 100; do
+	reload pg_cgroups.sample_interval ${interval}ms
+	set -- $(pgbench_run -S -c $clients -j $clients)
+	result sampling "interval=${interval}ms" tps $1 tps
+	result sampling "interval=${interval}ms" latency $2 ms
+done
+reset pg_cgroups.sample_interval
+
+if [ $fake = yes ]; then
+	log "skipping the enforcement benchmarks with a simulated control group file system"
+	exit 0
+fi
+
+# enforcement of "pg_cgroups.cpu_share"
+
+log "CPU share"
+
+set -- $(pgbench_run -S -c $clients -j $clients)
+baseline=$1
+result cpu_share unlimited tps $baseline tps
+
+ncpus=$(nproc)
+for share in 50000 100000 $(($ncpus * 50000)); do
+	reload pg_cgroups.cpu_share $share
+	set -- $(pgbench_run -S -c $clients -j $clients)
+	result cpu_share "cpu_share=$share" tps $1 tps
+	result cpu_share "cpu_share=$share" configured_fraction \
+		$(ratio $share $(($ncpus * 100000))) ratio
+	result cpu_share "cpu_share=$share" achieved_fraction \
+		$(ratio $1 $baseline) ratio
+done
+reset pg_cgroups.cpu_share
+
+# enforcement of "pg_cgroups.read_bps_limit"
+
+log "read limit"
+
+# the limit must be set on the disk that contains the data directory
+device=$(stat -c '%Hd:%Ld' "$datadir")
+if [ -e "/sys/dev/block/$device/partition" ]; then
+	device=$(cat "/sys/dev/block/$device/../dev")
+fi
+
+# read the whole table from disk and print the read rate in bytes per second
+read_rate() {
+	sql "SELECT pg_cgroups_reclaim(1024 * 1024 * 1024 * 1024::bigint)" >/dev/null
+	before=$(sql "SELECT read_bytes FROM pg_cgroups_io_stat() WHERE group_name IS NULL")
+	t0=$(now_ms)
+	sql "SELECT count(*) FROM pgbench_accounts" >/dev/null
+	t1=$(now_ms)
+	after=$(sql "SELECT read_bytes FROM pg_cgroups_io_stat() WHERE group_name IS NULL")
+	echo $((($after - $before) * 1000 / ($t1 - $t0 + 1)))
+}
+
+result read_bps_limit unlimited read_rate $(read_rate) bytes/s
+
+for limit in 10485760 52428800; do
+	reload pg_cgroups.read_bps_limit "$device $limit"
+	result read_bps_limit "read_bps_limit=$limit" configured_rate $limit bytes/s
+	result read_bps_limit "read_bps_limit=$limit" read_rate $(read_rate) bytes/s
+done
+reload pg_cgroups.read_bps_limit "$device 0"
+
+# enforcement of "pg_cgroups.memory_limit"
+
+log "memory limit"
+
+set -- $(pgbench_run -c $clients -j $clients)
+result memory_limit unlimited tps $1 tps
+
+limit=$(($(sql "SELECT setting::bigint * 8 / 1024 FROM pg_settings WHERE name = 'shared_buffers'") + 128))
+reload pg_cgroups.memory_limit $limit
+set -- $(pgbench_run -c $clients -j $clients)
+result memory_limit "memory_limit=$limit" tps $1 tps
+result memory_limit "memory_limit=$limit" configured_limit $(($limit * 1024 * 1024)) bytes
+sleep 1
+result memory_limit "memory_limit=$limit" max_usage \
+	$(sql "SELECT max_usage FROM pg_cgroups_memory") bytes
+result memory_limit "memory_limit=$limit" failures \
+	$(sql "SELECT failures FROM pg_cgroups_memory") count
+reset pg_cgroups.memory_limit
@@ -0,0 +1,237 @@
+#!/bin/sh
+#
+# Create a simulated control group (v1) file system for pg_cgroups.
+#
+# Usage: fake_cgroupfs.sh [options] directory
+#
+# Set "pg_cgroups.system_root" to the directory to run the extension
+# against the simulated tree without root privileges.
+#
+# Options:
+#   --cpus N            number of online CPUs (default 4)
+#   --nodes N           number of NUMA nodes (default 1)
+#   --no-memsw          no "memory.memsw.*" parameters, like a kernel
+#                       without swap accounting
+#   --no-kmem           no "memory.kmem.*" parameters, like a kernel
+#                       booted with "cgroup.memory=nokmem"
+#   --without NAME      don't set up the optional controller NAME
+#                       (freezer, pids, hugetlb, net_cls or net_prio)
+#   --separate-net      mount net_cls and net_prio separately instead of
+#                       together at "net_cls,net_prio" like systemd does
+#
+# The parameters are plain files, so the kernel's checks of the values
+# written to them are not simulated, except that pg_cgroups itself refuses
+# to set "memory.limit_in_bytes" above "memory.memsw.limit_in_bytes".
+
+set -e
+
+cpus=4
+nodes=1
+memsw=yes
+kmem=yes
+without=
+net=net_cls,net_prio
+
+while [ $# -gt 1 ]; do
+	case "$1" in
+		--cpus) cpus="$2"; shift 2;;
+		--nodes) nodes="$2"; shift 2;;
+		--no-memsw) memsw=no; shift;;
+		--no-kmem) kmem=no; shift;;
+		--without) without="$without $2"; shift 2;;
+		--separate-net) net="net_cls net_prio"; shift;;
+		*) echo "unknown option \"$1\"" >&2; exit 1;;
+	esac
+done
+
+if [ $# -ne 1 ]; then
+	echo "usage: $0 [options] directory" >&2
+	exit 1
+fi
+
+root="$1"
+unlimited=9223372036854771712
+
+if [ -e "$root" ]; then
+	echo "\"$root\" already exists" >&2
+	exit 1
+fi
+
+# write the arguments after the first to the file, one per line
+param() {
+	file="$1"
+	shift
+	if [ $# -eq 0 ]; then
+		: >"$file"
+	else
+		printf '%s\n' "$@" >"$file"
+	fi
+}
+
+used() {
+	case " $without " in
+		*" $1 "*) return 1;;
+	esac
+	return 0
+}
+
+range() {
+	if [ "$1" -eq 1 ]; then
+		echo 0
+	else
+		echo "0-$(($1 - 1))"
+	fi
+}
+
+mkdir -p "$root/proc" "$root/sys/fs/cgroup" "$root/sys/class/net/lo" \
+	"$root/sys/kernel/mm/hugepages/hugepages-2048kB"
+
+# net_cls and net_prio can only share a hierarchy if both are set up
+if ! used net_cls || ! used net_prio; then
+	net="net_cls net_prio"
+fi
+
+# the controllers and their mount points
+printf '#subsys_name\thierarchy\tnum_cgroups\tenabled\n' >"$root/proc/cgroups"
+: >"$root/proc/mounts"
+hierarchy=1
+for controller in memory cpu,cpuacct blkio cpuset freezer pids hugetlb $net; do
+	for name in $(echo $controller | tr , ' '); do
+		printf '%s\t%d\t1\t1\n' $name $hierarchy >>"$root/proc/cgroups"
+	done
+	echo "cgroup /sys/fs/cgroup/$controller cgroup rw,nosuid,nodev,noexec,relatime,$controller 0 0" \
+		>>"$root/proc/mounts"
+	hierarchy=$(($hierarchy + 1))
+done
+
+param "$root/proc/meminfo" \
+	"MemTotal:       16384000 kB" \
+	"MemFree:         8192000 kB" \
+	"Hugepagesize:       2048 kB"
+
+# CPUs and NUMA nodes
+mkdir -p "$root/sys/devices/system/cpu" "$root/sys/devices/system/node"
+range $cpus >"$root/sys/devices/system/cpu/online"
+range $nodes >"$root/sys/devices/system/node/online"
+node=0
+while [ $node -lt $nodes ]; do
+	# distribute the CPUs evenly over the nodes
+	first=$(($node * $cpus / $nodes))
+	last=$((($node + 1) * $cpus / $nodes - 1))
+	file="$root/sys/devices/system/node/node$node/cpulist"
+	mkdir "$root/sys/devices/system/node/node$node"
+	if [ $last -lt $first ]; then
+		param "$file"
+	elif [ $first -eq $last ]; then
+		param "$file" $first
+	else
+		param "$file" "$first-$last"
+	fi
+	node=$(($node + 1))
+done
+
+# the "/postgres" control groups with the parameters
+dir="$root/sys/fs/cgroup/memory/postgres"
+mkdir -p "$dir"
+param "$dir/tasks"
+param "$dir/cgroup.procs"
+param "$dir/memory.limit_in_bytes" $unlimited
+param "$dir/memory.soft_limit_in_bytes" $unlimited
+param "$dir/memory.usage_in_bytes" 0
+param "$dir/memory.max_usage_in_bytes" 0
+param "$dir/memory.failcnt" 0
+param "$dir/memory.swappiness" 60
+param "$dir/memory.oom_control" "oom_kill_disable 0" "under_oom 0"
+param "$dir/memory.stat" \
+	"cache 0" "rss 0" "shmem 0" "active_file 0" "inactive_file 0" \
+	"dirty 0" "writeback 0" "swap 0" \
+	"total_cache 0" "total_rss 0" "total_shmem 0" "total_active_file 0" \
+	"total_inactive_file 0" "total_dirty 0" "total_writeback 0" "total_swap 0"
+if [ $memsw = yes ]; then
+	param "$dir/memory.memsw.limit_in_bytes" $unlimited
+	param "$dir/memory.memsw.usage_in_bytes" 0
+	param "$dir/memory.memsw.max_usage_in_bytes" 0
+	param "$dir/memory.memsw.failcnt" 0
+fi
+if [ $kmem = yes ]; then
+	for prefix in memory.kmem memory.kmem.tcp; do
+		param "$dir/$prefix.limit_in_bytes" $unlimited
+		param "$dir/$prefix.usage_in_bytes" 0
+		param "$dir/$prefix.max_usage_in_bytes" 0
+		param "$dir/$prefix.failcnt" 0
+	done
+fi
+
+dir="$root/sys/fs/cgroup/cpu,cpuacct/postgres"
+mkdir -p "$dir"
+param "$dir/tasks"
+param "$dir/cgroup.procs"
+param "$dir/cpu.shares" 1024
+param "$dir/cpu.cfs_period_us" 100000
+param "$dir/cpu.cfs_quota_us" -1
+param "$dir/cpu.stat" "nr_periods 0" "nr_throttled 0" "throttled_time 0"
+param "$dir/cpuacct.usage" 0
+
+dir="$root/sys/fs/cgroup/blkio/postgres"
+mkdir -p "$dir"
+param "$dir/tasks"
+param "$dir/cgroup.procs"
+param "$dir/blkio.weight" 500
+for p in read_bps_device write_bps_device read_iops_device write_iops_device; do
+	param "$dir/blkio.throttle.$p"
+done
+for p in io_service_bytes io_serviced io_service_bytes_recursive io_serviced_recursive; do
+	param "$dir/blkio.throttle.$p" "Total 0"
+done
+
+dir="$root/sys/fs/cgroup/cpuset/postgres"
+mkdir -p "$dir"
+param "$dir/tasks"
+param "$dir/cgroup.procs"
+param "$dir/cpuset.cpus"
+param "$dir/cpuset.mems"
+
+if used freezer; then
+	dir="$root/sys/fs/cgroup/freezer/postgres"
+	mkdir -p "$dir"
+	param "$dir/tasks"
+	param "$dir/cgroup.procs"
+	param "$dir/freezer.state" THAWED
+fi
+
+if used pids; then
+	dir="$root/sys/fs/cgroup/pids/postgres"
+	mkdir -p "$dir"
+	param "$dir/tasks"
+	param "$dir/cgroup.procs"
+	param "$dir/pids.max" max
+	param "$dir/pids.current" 0
+	param "$dir/pids.events" "max 0"
+fi
+
+if used hugetlb; then
+	dir="$root/sys/fs/cgroup/hugetlb/postgres"
+	mkdir -p "$dir"
+	param "$dir/tasks"
+	param "$dir/cgroup.procs"
+	param "$dir/hugetlb.2MB.limit_in_bytes" $unlimited
+	param "$dir/hugetlb.2MB.usage_in_bytes" 0
+	param "$dir/hugetlb.2MB.max_usage_in_bytes" 0
+	param "$dir/hugetlb.2MB.failcnt" 0
+fi
+
+if used net_cls; then
+	dir="$root/sys/fs/cgroup/${net% net_prio}/postgres"
+	mkdir -p "$dir"
+	param "$dir/tasks"
+	param "$dir/cgroup.procs"
+	param "$dir/net_cls.classid" 0
+fi
+
+if used net_prio; then
+	dir="$root/sys/fs/cgroup/${net#net_cls }/postgres"
+	mkdir -p "$dir"
+	param "$dir/tasks"
+	param "$dir/cgroup.procs"
+	param "$dir/net_prio.ifpriomap" "lo 0"
+fi
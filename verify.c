@@ -0,0 +1,857 @@
+#ifndef __linux__
+#error "Linux control groups are only available on Linux"
+#endif
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+
+#include "access/htup_details.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pg_cgroups.h"
+
+/*
+ * The verifier compares the control group parameters that pg_cgroups has
+ * written with what the kernel reports, since other software can change
+ * them behind our back, and "SHOW" only reports the parameter's value.
+ *
+ * - The postmaster records each value that it writes and reads the
+ *   parameter back right away.  Since the postmaster must not wait for
+ *   locks, it publishes the values in shared memory with a change count,
+ *   like PostgreSQL does for the backend status.
+ * - The monitor checks changed values after the next sample and all values
+ *   every "pg_cgroups.verify_interval".  It records mismatches in shared
+ *   memory and writes the expected value again if "pg_cgroups.reapply_drift"
+ *   is enabled.
+ * - A value that another process writes, like the autovacuum I/O budget
+ *   that the monitor sets, is expected until the postmaster writes the
+ *   parameter again.
+ */
+
+PG_FUNCTION_INFO_V1(pg_cgroups_verification);
+
+#define MAX_VERIFIED 256
+#define VERIFY_NAME_LEN 64
+#define VERIFY_PATH_LEN 112		/* "postgres/<pid>/<group>" */
+#define VERIFY_VALUE_LEN 256
+
+/* the largest huge page size, to which the kernel rounds "hugetlb" limits */
+#define MAX_HUGE_PAGE_SIZE INT64CONST(1073741824)
+
+/* the kernel reports this (or more) for a memory limit of -1 */
+#define UNLIMITED_MEMORY (INT64CONST(0x7FFFFFFFFFFFF000) / 2)
+
+/* the highest CPU or memory node number that we can verify */
+#define MAX_LIST_MEMBER 8191
+
+/* a parameter value as the postmaster wrote it */
+typedef struct
+{
+	int			controller;
+	char		cgroup[VERIFY_PATH_LEN];	/* relative to the mount point */
+	char		parameter[VERIFY_NAME_LEN];
+	char		key[VERIFY_NAME_LEN];	/* device or interface, "" if none */
+	char		value[VERIFY_VALUE_LEN];	/* for "key", if there is one */
+} VerifiedValue;
+
+typedef struct
+{
+	uint32		changecount;	/* odd while the postmaster writes "value" */
+	VerifiedValue value;
+} SharedValue;
+
+/* what the monitor found out about a value */
+typedef struct
+{
+	uint32		checked_count;	/* "changecount" at the last check */
+	uint32		override_count;	/* "changecount" when "override" was written */
+	bool		has_override;
+	char		override[VERIFY_VALUE_LEN];	/* written by another process */
+	char		observed[VERIFY_VALUE_LEN];
+	TimestampTz	drift_since;	/* 0 if the kernel agrees */
+	TimestampTz	last_check;		/* 0 if not checked yet */
+	int64		reapplied;
+} VerifyState;
+
+typedef struct
+{
+	int			num_values;		/* only the postmaster increases this */
+	SharedValue	values[MAX_VERIFIED];
+	slock_t		mutex;			/* protects "state" */
+	VerifyState	state[MAX_VERIFIED];
+} VerifyShared;
+
+static VerifyShared *verify = NULL;
+
+/* the postmaster's copy of the values, which survives a crash restart */
+static VerifiedValue *local_values = NULL;
+static int num_local_values = 0;
+
+/* GUCs defined by the verifier */
+static int verify_interval = 60;
+static bool reapply_drift = false;
+
+/* saved hook values */
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* static functions declarations */
+#if PG_VERSION_NUM >= 150000
+static void verify_shmem_request(void);
+#endif
+static void verify_shmem_startup(void);
+static void verify_write(int controller, char * const cgroup, char * const parameter, char * const value);
+static bool is_verified(char * const parameter);
+static bool is_keyed(char * const parameter);
+static void write_value(int controller, char * const cgroup, char * const parameter, char * const key, char * const value);
+static void record_value(int controller, char * const cgroup, char * const parameter, char * const key, char * const value);
+static void publish_value(int i);
+static void override_value(int controller, char * const cgroup, char * const parameter, char * const key, char * const value);
+static uint32 copy_value(int i, VerifiedValue *copy);
+static bool same_setting(VerifiedValue *v, int controller, char * const cgroup, char * const parameter, char * const key);
+static char *find_line(char * const contents, char * const key);
+static char *comparable(VerifiedValue *v, char * const contents);
+static bool values_match(char * const parameter, char * const expected, char * const observed);
+static bool lists_match(char * const expected, char * const observed, char * const online);
+static bool *list_members(char * const list);
+static char *read_value(VerifiedValue *v);
+static void check_value(int i, bool all, TimestampTz now);
+static char *group_of(char * const cgroup);
+
+/*
+ * Define the GUCs, request shared memory and install the hooks.
+ * This is called from _PG_init() before anything is written to the kernel.
+ */
+void
+verify_init(void)
+{
+	DefineCustomIntVariable(
+		"pg_cgroups.verify_interval",
+		"Interval for comparing the control group parameters with the settings.",
+		"0 disables the periodic checks.",
+		&verify_interval,
+		60,
+		0,
+		INT_MAX / 1000,
+		PGC_SIGHUP,
+		GUC_UNIT_S,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomBoolVariable(
+		"pg_cgroups.reapply_drift",
+		"Write control group parameters again that were changed by somebody else.",
+		NULL,
+		&reapply_drift,
+		false,
+		PGC_SIGHUP,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	local_values = MemoryContextAllocZero(TopMemoryContext,
+										  sizeof(VerifiedValue) * MAX_VERIFIED);
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = verify_shmem_request;
+#else
+	RequestAddinShmemSpace(MAXALIGN(sizeof(VerifyShared)));
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = verify_shmem_startup;
+
+	cg_write_hook = verify_write;
+}
+
+#if PG_VERSION_NUM >= 150000
+void
+verify_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(MAXALIGN(sizeof(VerifyShared)));
+}
+#endif
+
+/*
+ * After a crash restart, shared memory is initialized again,
+ * so the postmaster publishes all its values.
+ */
+void
+verify_shmem_startup(void)
+{
+	bool found;
+	int i;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	verify = ShmemInitStruct("pg_cgroups verifier",
+							 sizeof(VerifyShared),
+							 &found);
+	if (!found)
+	{
+		memset(verify, 0, sizeof(VerifyShared));
+		SpinLockInit(&verify->mutex);
+
+		for (i=0; i<num_local_values; ++i)
+			publish_value(i);
+		verify->num_values = num_local_values;
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * This is called for every parameter that pg_cgroups writes.
+ * Files with a list of per-device or per-interface values are split
+ * into lines, and each line is verified on its own.
+ */
+void
+verify_write(int controller, char * const cgroup, char * const parameter, char * const value)
+{
+	char *copy, *line, *next;
+	int i;
+
+	/* "/postgres" is shared with other clusters */
+	if (strncmp(cgroup, "postgres/", 9) != 0
+		|| strlen(cgroup) >= VERIFY_PATH_LEN
+		|| !is_verified(parameter))
+		return;
+
+	if (!is_keyed(parameter))
+	{
+		write_value(controller, cgroup, parameter, "", value);
+		return;
+	}
+
+	/*
+	 * The postmaster writes the complete list of device limits, but
+	 * the kernel keeps limits that are not in the list, so we expect
+	 * them to be removed.
+	 */
+	if (MyProcPid == PostmasterPid && strncmp(parameter, "blkio.throttle.", 15) == 0)
+		for (i=0; i<num_local_values; ++i)
+		{
+			VerifiedValue *v = &local_values[i];
+
+			if (v->controller == controller
+				&& strcmp(v->cgroup, cgroup) == 0
+				&& strcmp(v->parameter, parameter) == 0
+				&& find_line(value, v->key) == NULL)
+				write_value(controller, cgroup, parameter, v->key,
+							psprintf("%s 0", v->key));
+		}
+
+	copy = pstrdup(value);
+	for (line = copy; line != NULL; line = next)
+	{
+		size_t len;
+
+		if ((next = strchr(line, '\n')) != NULL)
+			*(next++) = '\0';
+
+		len = strcspn(line, " ");
+		if (len == 0 || line[len] == '\0' || len >= VERIFY_NAME_LEN)
+			continue;
+
+		write_value(controller, cgroup, parameter, pnstrdup(line, len), line);
+	}
+
+	pfree(copy);
+}
+
+/* actions and states are not verified, only settings */
+bool
+is_verified(char * const parameter)
+{
+	return (strcmp(parameter, "cgroup.procs") != 0
+			&& strcmp(parameter, "tasks") != 0
+			&& strcmp(parameter, "freezer.state") != 0
+			&& strcmp(parameter, "memory.force_empty") != 0);
+}
+
+/* parameters that contain one line per device or network interface */
+bool
+is_keyed(char * const parameter)
+{
+	size_t len = strlen(parameter);
+
+	return ((len > 7 && strcmp(parameter + len - 7, "_device") == 0)
+			|| strcmp(parameter, "net_prio.ifpriomap") == 0);
+}
+
+/*
+ * The postmaster records a value and reads it back,
+ * other processes override the postmaster's value.
+ */
+void
+write_value(int controller, char * const cgroup, char * const parameter, char * const key, char * const value)
+{
+	VerifiedValue v;
+	char *expected, *observed;
+
+	if (strlen(value) >= VERIFY_VALUE_LEN)
+	{
+		elog(DEBUG1, "value of \"%s\" is too long to be verified", parameter);
+		return;
+	}
+
+	if (MyProcPid != PostmasterPid)
+	{
+		override_value(controller, cgroup, parameter, key, value);
+		return;
+	}
+
+	record_value(controller, cgroup, parameter, key, value);
+
+	memset(&v, 0, sizeof(VerifiedValue));
+	v.controller = controller;
+	strlcpy(v.cgroup, cgroup, VERIFY_PATH_LEN);
+	strlcpy(v.parameter, parameter, VERIFY_NAME_LEN);
+	strlcpy(v.key, key, VERIFY_NAME_LEN);
+
+	expected = comparable(&v, value);
+	observed = comparable(&v, read_value(&v));
+
+	if (!values_match(parameter, expected, observed))
+		ereport(WARNING,
+				(errcode(ERRCODE_SYSTEM_ERROR),
+				 errmsg("the kernel reports \"%s\" for parameter \"%s%s%s\" of control group \"%s\" after \"%s\" was written",
+						observed, parameter, *key ? " " : "", key, cgroup, expected)));
+}
+
+/* store a value in the postmaster's copy and publish it */
+void
+record_value(int controller, char * const cgroup, char * const parameter, char * const key, char * const value)
+{
+	int i;
+
+	for (i=0; i<num_local_values; ++i)
+		if (same_setting(&local_values[i], controller, cgroup, parameter, key))
+			break;
+
+	if (i == MAX_VERIFIED)
+	{
+		static bool warned = false;
+
+		if (!warned)
+			ereport(LOG,
+					(errmsg("too many control group parameters, only %d can be verified",
+							MAX_VERIFIED)));
+		warned = true;
+
+		return;
+	}
+
+	if (i == num_local_values)
+	{
+		VerifiedValue *v = &local_values[i];
+
+		v->controller = controller;
+		strlcpy(v->cgroup, cgroup, VERIFY_PATH_LEN);
+		strlcpy(v->parameter, parameter, VERIFY_NAME_LEN);
+		strlcpy(v->key, key, VERIFY_NAME_LEN);
+	}
+
+	strlcpy(local_values[i].value, value, VERIFY_VALUE_LEN);
+
+	if (verify != NULL)
+		publish_value(i);
+
+	if (i == num_local_values)
+	{
+		++num_local_values;
+
+		/* readers must see the new value before they see the count */
+		if (verify != NULL)
+		{
+			pg_write_barrier();
+			verify->num_values = num_local_values;
+		}
+	}
+}
+
+/*
+ * Copy a value to shared memory.  Readers retry while the change count
+ * is odd or has changed during their read, so the postmaster never waits.
+ */
+void
+publish_value(int i)
+{
+	volatile SharedValue *shared = &verify->values[i];
+
+	shared->changecount++;
+	pg_write_barrier();
+	memcpy((void *) &shared->value, &local_values[i], sizeof(VerifiedValue));
+	pg_write_barrier();
+	shared->changecount++;
+}
+
+/*
+ * Read a value from shared memory.
+ * Returns the change count of the value.
+ */
+uint32
+copy_value(int i, VerifiedValue *copy)
+{
+	volatile SharedValue *shared = &verify->values[i];
+
+	for (;;)
+	{
+		uint32 before, after;
+
+		before = shared->changecount;
+		pg_read_barrier();
+		memcpy(copy, (const void *) &shared->value, sizeof(VerifiedValue));
+		pg_read_barrier();
+		after = shared->changecount;
+
+		if (before == after && (before & 1) == 0)
+			return before;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+/* remember a value that a process other than the postmaster has written */
+void
+override_value(int controller, char * const cgroup, char * const parameter, char * const key, char * const value)
+{
+	VerifiedValue v;
+	int i, num_values;
+
+	if (verify == NULL)
+		return;
+
+	num_values = verify->num_values;
+	pg_read_barrier();
+
+	for (i=0; i<num_values; ++i)
+	{
+		uint32 count = copy_value(i, &v);
+
+		if (same_setting(&v, controller, cgroup, parameter, key))
+		{
+			volatile VerifyState *state = &verify->state[i];
+
+			SpinLockAcquire(&verify->mutex);
+			state->has_override = true;
+			state->override_count = count;
+			strlcpy((char *) state->override, value, VERIFY_VALUE_LEN);
+			SpinLockRelease(&verify->mutex);
+
+			return;
+		}
+	}
+}
+
+bool
+same_setting(VerifiedValue *v, int controller, char * const cgroup, char * const parameter, char * const key)
+{
+	return (v->controller == controller
+			&& strcmp(v->cgroup, cgroup) == 0
+			&& strcmp(v->parameter, parameter) == 0
+			&& strcmp(v->key, key) == 0);
+}
+
+/*
+ * Find the line that starts with "key" and a space.
+ * Returns a palloc'ed copy of the rest of the line, or NULL.
+ */
+char *
+find_line(char * const contents, char * const key)
+{
+	char *p = contents;
+	size_t len = strlen(key);
+
+	while (p != NULL && *p != '\0')
+	{
+		if (strncmp(p, key, len) == 0 && p[len] == ' ')
+		{
+			p += len;
+			while (*p == ' ')
+				++p;
+
+			return pnstrdup(p, strcspn(p, "\n"));
+		}
+
+		if ((p = strchr(p, '\n')) != NULL)
+			++p;
+	}
+
+	return NULL;
+}
+
+/*
+ * Extract the part of a parameter's contents that corresponds to a value.
+ * Returns a palloc'ed string without surrounding white space.
+ */
+char *
+comparable(VerifiedValue *v, char * const contents)
+{
+	char *result = NULL, *end;
+
+	if (*v->key != '\0')
+	{
+		/* the kernel removes entries that are set to 0 */
+		if ((result = find_line(contents, v->key)) == NULL)
+			result = pstrdup("0");
+	}
+	else if (strcmp(v->parameter, "memory.oom_control") == 0)
+		result = find_line(contents, "oom_kill_disable");
+
+	if (result == NULL)
+	{
+		/* "blkio.bfq.weight" starts with "default" */
+		if (strncmp(contents, "default ", 8) == 0)
+			result = pstrdup(contents + 8);
+		else
+			result = pstrdup(contents);
+	}
+
+	while (*result == ' ')
+		++result;
+	end = result + strlen(result);
+	while (end > result && (end[-1] == '\n' || end[-1] == ' '))
+		*(--end) = '\0';
+
+	return result;
+}
+
+/*
+ * Compare an expected value with the value that the kernel reports.
+ * The kernel rounds memory limits down to whole pages, and it removes
+ * CPUs and memory nodes from a cpuset when they go offline.
+ */
+bool
+values_match(char * const parameter, char * const expected, char * const observed)
+{
+	int64_t exp_num, obs_num;
+	char *end;
+
+	if (strcmp(parameter, "cpuset.cpus") == 0)
+		return lists_match(expected, observed, get_def_cpus());
+
+	if (strcmp(parameter, "cpuset.mems") == 0)
+		return lists_match(expected, observed, get_def_memory_nodes());
+
+	if (strcmp(expected, observed) == 0)
+		return true;
+
+	errno = 0;
+	exp_num = strtoll(expected, &end, 10);
+	if (*expected == '\0' || *end != '\0' || errno != 0)
+		return false;
+	obs_num = strtoll(observed, &end, 10);
+	if (*observed == '\0' || *end != '\0' || errno != 0)
+		return false;
+
+	if (exp_num == obs_num)
+		return true;
+
+	if (strstr(parameter, "limit_in_bytes") == NULL)
+		return false;
+
+	if (exp_num == -1)
+		return (obs_num >= UNLIMITED_MEMORY);
+
+	return (obs_num <= exp_num
+			&& exp_num - obs_num < (strncmp(parameter, "hugetlb.", 8) == 0
+									? MAX_HUGE_PAGE_SIZE
+									: sysconf(_SC_PAGESIZE)));
+}
+
+/* compare lists of CPUs or memory nodes, ignoring those that are offline */
+bool
+lists_match(char * const expected, char * const observed, char * const online)
+{
+	bool *exp_members, *obs_members, *online_members;
+	int i;
+
+	if ((exp_members = list_members(expected)) == NULL
+		|| (obs_members = list_members(observed)) == NULL
+		|| (online_members = list_members(online)) == NULL)
+		return false;
+
+	for (i=0; i<=MAX_LIST_MEMBER; ++i)
+		if ((exp_members[i] && online_members[i]) != obs_members[i])
+			return false;
+
+	return true;
+}
+
+/*
+ * Convert a list like "0-3,7" to an array of flags.
+ * Returns NULL if the list cannot be parsed.
+ */
+bool *
+list_members(char * const list)
+{
+	bool *members = palloc0(sizeof(bool) * (MAX_LIST_MEMBER + 1));
+	char *p = list;
+
+	while (*p != '\0')
+	{
+		long first, last, i;
+		char *end;
+
+		first = last = strtol(p, &end, 10);
+		if (end == p)
+			return NULL;
+		p = end;
+
+		if (*p == '-')
+		{
+			last = strtol(p + 1, &end, 10);
+			if (end == p + 1)
+				return NULL;
+			p = end;
+		}
+
+		if (first < 0 || last > MAX_LIST_MEMBER || first > last)
+			return NULL;
+
+		for (i=first; i<=last; ++i)
+			members[i] = true;
+
+		if (*p == ',')
+			++p;
+		else if (*p != '\0')
+			return NULL;
+	}
+
+	return members;
+}
+
+/* read the contents of a parameter, an empty string on error */
+char *
+read_value(VerifiedValue *v)
+{
+	char *contents;
+
+	contents = cg_read_string(v->controller, v->cgroup, v->parameter, true);
+
+	return contents ? contents : pstrdup("");
+}
+
+/*
+ * Check the values that have changed since the last check, and all values
+ * every "verify_interval".  The monitor calls this after each sample.
+ */
+void
+verify_policy(void)
+{
+	static TimestampTz last_time = 0;
+	TimestampTz now = GetCurrentTimestamp();
+	bool all = false;
+	int i, num_values;
+
+	if (verify_interval > 0
+		&& (last_time == 0
+			|| TimestampDifferenceExceeds(last_time, now, verify_interval * 1000)))
+	{
+		all = true;
+		last_time = now;
+	}
+
+	num_values = verify->num_values;
+	pg_read_barrier();
+
+	for (i=0; i<num_values; ++i)
+		check_value(i, all, now);
+}
+
+/* compare a value with the kernel's and record the result */
+void
+check_value(int i, bool all, TimestampTz now)
+{
+	volatile VerifyState *state = &verify->state[i];
+	VerifiedValue v;
+	char expected[VERIFY_VALUE_LEN], *expect, *observed, *found;
+	uint32 count;
+	bool changed, drifted, matches, reapplied = false;
+
+	count = copy_value(i, &v);
+
+	SpinLockAcquire(&verify->mutex);
+	changed = (state->last_check == 0 || state->checked_count != count);
+	if (state->has_override && state->override_count == count)
+		strlcpy(expected, (char *) state->override, VERIFY_VALUE_LEN);
+	else
+		strlcpy(expected, v.value, VERIFY_VALUE_LEN);
+	drifted = (state->drift_since != 0 && !changed);
+	SpinLockRelease(&verify->mutex);
+
+	if (!all && !changed)
+		return;
+
+	expect = comparable(&v, expected);
+	observed = found = comparable(&v, read_value(&v));
+	matches = values_match(v.parameter, expect, observed);
+
+	if (!matches && reapply_drift
+		&& cg_try_write_string(v.controller, v.cgroup, v.parameter, expected))
+	{
+		observed = comparable(&v, read_value(&v));
+		reapplied = matches = values_match(v.parameter, expect, observed);
+	}
+
+	SpinLockAcquire(&verify->mutex);
+	state->checked_count = count;
+	state->last_check = now;
+	strlcpy((char *) state->observed, observed, VERIFY_VALUE_LEN);
+	if (reapplied)
+		state->reapplied++;
+	if (matches)
+		state->drift_since = 0;
+	else if (!drifted)
+		state->drift_since = now;
+	SpinLockRelease(&verify->mutex);
+
+	if (reapplied)
+		ereport(LOG,
+				(errmsg("parameter \"%s%s%s\" of control group \"%s\" was \"%s\", wrote \"%s\" again",
+						v.parameter, *v.key ? " " : "", v.key, v.cgroup, found, expect)));
+	else if (!matches && !drifted)
+		ereport(LOG,
+				(errmsg("parameter \"%s%s%s\" of control group \"%s\" is \"%s\" rather than \"%s\"",
+						v.parameter, *v.key ? " " : "", v.key, v.cgroup, observed, expect),
+				 errhint("Enable \"pg_cgroups.reapply_drift\" to write the value again.")));
+}
+
+/*
+ * Get the group from a control group path like "postgres/1234/reporting".
+ * Returns NULL for the cluster's control group.
+ */
+char *
+group_of(char * const cgroup)
+{
+	char *p = strchr(cgroup + 9, '/');
+
+	return p ? p + 1 : NULL;
+}
+
+/*
+ * SQL function that returns the verified parameters, the values
+ * that pg_cgroups expects, and the values that the kernel reported
+ * at the last check.
+ */
+Datum
+pg_cgroups_verification(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	Datum *rows;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		TupleDesc tupdesc;
+		int i, num_values;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		tupdesc = BlessTupleDesc(tupdesc);
+
+		num_values = verify->num_values;
+		pg_read_barrier();
+
+		/* build all rows now, so that they are consistent */
+		rows = palloc(sizeof(Datum) * (num_values + 1));
+		for (i=0; i<num_values; ++i)
+		{
+			VerifiedValue v;
+			VerifyState state;
+			Datum values[8];
+			bool nulls[8] = {false, false, false, false, false, false, false, false};
+			char *group;
+			uint32 count;
+
+			count = copy_value(i, &v);
+
+			SpinLockAcquire(&verify->mutex);
+			state = *((VerifyState *) &verify->state[i]);
+			SpinLockRelease(&verify->mutex);
+
+			if ((group = group_of(v.cgroup)) == NULL)
+				nulls[0] = true;
+			else
+				values[0] = CStringGetTextDatum(group);
+
+			values[1] = CStringGetTextDatum(v.parameter);
+
+			if (*v.key == '\0')
+				nulls[2] = true;
+			else
+				values[2] = CStringGetTextDatum(v.key);
+
+			values[3] = CStringGetTextDatum(
+				comparable(&v, (state.has_override && state.override_count == count)
+							   ? state.override : v.value));
+
+			/* the values are not checked yet */
+			if (state.last_check == 0 || state.checked_count != count)
+			{
+				nulls[4] = true;
+				nulls[5] = true;
+				nulls[6] = true;
+			}
+			else
+			{
+				values[4] = CStringGetTextDatum(state.observed);
+
+				if (state.drift_since == 0)
+					nulls[5] = true;
+				else
+					values[5] = TimestampTzGetDatum(state.drift_since);
+
+				values[6] = TimestampTzGetDatum(state.last_check);
+			}
+
+			values[7] = Int64GetDatum(state.reapplied);
+
+			rows[i] = HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls));
+		}
+
+		funcctx->max_calls = num_values;
+		funcctx->user_fctx = rows;
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	rows = (Datum *) funcctx->user_fctx;
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+		SRF_RETURN_NEXT(funcctx, rows[funcctx->call_cntr]);
+
+	SRF_RETURN_DONE(funcctx);
+}